@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "BatchRnn.h"
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+BatchRnn::BatchRnn(Model& modelRef, int B, int T, double learningRate)
+    : model_(modelRef),
+      histories_(B),
+      firstHidden_(B, modelRef.m_),
+      xt_(T, std::vector<int>(B, 0)),
+      xtp1_(T, std::vector<int>(B, 0)),
+      historyIds_(T, std::vector<int>(B, 0)),
+      ht_(T, Matrix(B, modelRef.m_)),
+      yt_(T, Matrix(B, modelRef.d_)),
+      order_(T),
+      groups_(T),
+      delta_(B, modelRef.m_),
+      hSorted_(B, modelRef.m_),
+      dTemp_(B, modelRef.d_),
+      lambdaSorted_(B, modelRef.m_),
+      lambda_(B, modelRef.m_) {
+  B_ = B;
+  T_ = T;
+  lr_ = learningRate;
+  lr0_ = learningRate;
+  reset();
+}
+
+void BatchRnn::reset() {
+  firstHidden_.fillValue(0.0);
+  step_ = 0;
+}
+
+void BatchRnn::updateLearningRate(double shrinkVal) {
+  lr_ /= shrinkVal;
+  if (lr_ < 0.0001 * lr0_) {
+    lr_ = 0.0001 * lr0_;
+  }
+}
+
+double BatchRnn::getLr() {
+  return lr_;
+}
+
+// forward of the tokens loaded at step t, returns the sum of their entropies
+double BatchRnn::forward(int t) {
+  int m = model_.m_;
+  Matrix& h = ht_[t];
+  Matrix& htm1 = t == 0 ? firstHidden_ : ht_[t - 1];
+  std::vector<int>& ids = historyIds_[t];
+
+  for (int b=0; b<B_; b++) {
+    std::copy(model_.A_.data_ + (size_t) xt_[t][b] * m,
+        model_.A_.data_ + (size_t) (xt_[t][b] + 1) * m, h.data_ + b * m);
+  }
+  h.matrixMatrix(1.0, htm1, false, model_.R_, true, 1.0);
+  h.sigmoid();
+
+  // grouping the streams by history
+  std::vector<int>& order = order_[t];
+  order.resize(B_);
+  for (int b=0; b<B_; b++) {
+    order[b] = b;
+  }
+  std::stable_sort(order.begin(), order.end(), [&ids](int a, int b) {
+      return ids[a] < ids[b];
+  });
+  std::vector<int>& groups = groups_[t];
+  groups.assign(1, 0);
+  for (int r=1; r<B_; r++) {
+    if (ids[order[r]] != ids[order[r - 1]]) {
+      groups.push_back(r);
+    }
+  }
+  groups.push_back(B_);
+  for (int r=0; r<B_; r++) {
+    std::copy(h.data_ + order[r] * m, h.data_ + (order[r] + 1) * m,
+        hSorted_.data_ + r * m);
+  }
+
+  // a product with the output matrix of each group, a single stream being
+  // a matrix-vector product
+  double entropy = 0.0;
+  Matrix Ut;
+  Matrix hg;
+  Matrix yg;
+  for (int g=0; g+1<groups.size(); g++) {
+    int begin = groups[g];
+    int n = groups[g + 1] - begin;
+    model_.getHistory(ids[order[begin]], Ut);
+    hg.setView(hSorted_, begin, n);
+    yg.setView(yt_[t], begin, n);
+    yg.matrixMatrix(1.0, hg, false, Ut, true, 0.0);
+  }
+  yt_[t].softMaxRows();
+  for (int r=0; r<B_; r++) {
+    entropy -= log(yt_[t].data_[r * model_.d_ + xtp1_[t][order[r]]])
+        / log(2.0);
+  }
+  return entropy;
+}
+
+// backward of step t, delta_ holds the delta of the hiddens of step t + 1
+// and is replaced by the one of step t
+void BatchRnn::backwardStep(int t) {
+  int m = model_.m_;
+  int d = model_.d_;
+  Matrix& h = ht_[t];
+  Matrix& htm1 = t == 0 ? firstHidden_ : ht_[t - 1];
+  std::vector<int>& order = order_[t];
+  std::vector<int>& groups = groups_[t];
+  std::vector<int>& ids = historyIds_[t];
+
+  // computing derivatives of the outputs
+  for (int r=0; r<B_; r++) {
+    double* row = dTemp_.data_ + r * d;
+    const double* y = yt_[t].data_ + r * d;
+    for (int j=0; j<d; j++) {
+      row[j] = -y[j] / log(2.0);
+    }
+    row[xtp1_[t][order[r]]] += 1 / log(2.0);
+    std::copy(h.data_ + order[r] * m, h.data_ + (order[r] + 1) * m,
+        hSorted_.data_ + r * m);
+  }
+
+  // the output matrices and their gradients, by group
+  Matrix Ut;
+  Matrix gUt;
+  Matrix dg;
+  Matrix hg;
+  Matrix lg;
+  for (int g=0; g+1<groups.size(); g++) {
+    int begin = groups[g];
+    int n = groups[g + 1] - begin;
+    int id = ids[order[begin]];
+    model_.getHistory(id, Ut);
+    model_.getHistoryGradient(id, gUt);
+    dg.setView(dTemp_, begin, n);
+    hg.setView(hSorted_, begin, n);
+    lg.setView(lambdaSorted_, begin, n);
+    lg.matrixMatrix(1.0, dg, false, Ut, false, 0.0);
+    gUt.matrixMatrix(-1.0, dg, true, hg, false, 1.0);
+    model_.ngramHistory_.insert(id);
+  }
+
+  // computing derivatives of the hiddens
+  lambda_.matrixMatrix(1.0, delta_, false, model_.R_, false, 0.0);
+  for (int r=0; r<B_; r++) {
+    double* row = lambda_.data_ + order[r] * m;
+    const double* l = lambdaSorted_.data_ + r * m;
+    for (int j=0; j<m; j++) {
+      row[j] += l[j];
+    }
+  }
+  delta_.copy(h);
+  delta_.aTimesOneMinusA();
+  delta_.timesInPlace(lambda_);
+
+  // computing the gradients
+  model_.gR_.matrixMatrix(-1.0, delta_, true, htm1, false, 1.0);
+  for (int b=0; b<B_; b++) {
+    double* g = model_.gA_.data_ + (size_t) xt_[t][b] * m;
+    for (int j=0; j<m; j++) {
+      g[j] -= delta_.data_[b * m + j];
+    }
+  }
+}
+
+// the gradients of the streams are summed, the step is the one of a single
+// window
+void BatchRnn::backward() {
+  model_.resetGradients();
+  delta_.fillValue(0.0);
+  for (int t=T_-1; t>=0; t--) {
+    backwardStep(t);
+  }
+  model_.update(lr_ / T_);
+  model_.resetGradients();
+}
+
+// one pass over the training tokens, the numTokens % B last ones being left,
+// returns the entropy per token
+double BatchRnn::train(DataProvider& dp, double& seconds) {
+  size_t nSteps = dp.getNumTokens() / B_;
+  std::vector<TokenCursor> cursors;
+  for (int b=0; b<B_; b++) {
+    cursors.push_back(dp.getCursor(b * nSteps, (b + 1) * nSteps));
+  }
+
+  double entropy = 0.0;
+  auto tic = std::chrono::steady_clock::now();
+  for (size_t s=0; s<nSteps; s++) {
+    // the histories of the step are known to the model before its output
+    // slab is viewed, adding one can move it
+    for (int b=0; b<B_; b++) {
+      dp.getToken(cursors[b], xt_[step_][b], xtp1_[step_][b], histories_[b]);
+      std::wstring history = dp.getHistory(histories_[b]);
+      int id = model_.getHistoryId(history);
+      if (id < 0) {
+        id = model_.addHistory(history);
+      }
+      historyIds_[step_][b] = id;
+    }
+    entropy += forward(step_);
+    step_++;
+    if (step_ == T_) {
+      backward();
+      firstHidden_.copy(ht_[T_ - 1]);
+      step_ = 0;
+    }
+  }
+  auto toc = std::chrono::steady_clock::now();
+  seconds = std::chrono::duration_cast<std::chrono::milliseconds>
+      (toc - tic).count() / 1000.0;
+  return entropy / (nSteps * B_);
+}
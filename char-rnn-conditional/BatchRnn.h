@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef BATCHRNN_H
+#define BATCHRNN_H
+
+#include "Model.h"
+#include "Matrix.h"
+#include "DataProvider.h"
+#include <vector>
+#include <string>
+
+// Trains a model on B streams at once, stream b reading the b-th of B
+// contiguous shards of the training tokens with its own ngram history. The
+// hiddens of the streams are the rows of matrices, so the recurrence is one
+// matrix-matrix product per step. The output matrix depends on the history
+// of each stream: the rows of a step are grouped by history, each group
+// being multiplied by its output matrix and its gradient summed into the
+// slab of gU_. The gradients of the B windows are applied once per window.
+class BatchRnn {
+  private:
+    Model& model_;
+    int B_;
+    int T_;
+    int step_;
+    double lr_;
+    double lr0_;
+
+    // raw history of each stream, trimmed to a valid ngram at every token
+    std::vector<std::wstring> histories_;
+
+    // hiddens carried from the previous window, one row per stream
+    Matrix firstHidden_;
+
+    // input of every step, in stream order
+    std::vector<std::vector<int>> xt_;
+    std::vector<std::vector<int>> xtp1_;
+    std::vector<std::vector<int>> historyIds_;
+
+    // hiddens in stream order, outputs in the order of the groups:
+    // order_[t][r] is the stream of row r and the rows [groups_[t][g],
+    // groups_[t][g + 1]) share a history
+    std::vector<Matrix> ht_;
+    std::vector<Matrix> yt_;
+    std::vector<std::vector<int>> order_;
+    std::vector<std::vector<int>> groups_;
+
+    // delta of the hiddens, passed to the step before
+    Matrix delta_;
+
+    // temporaries
+    Matrix hSorted_;
+    Matrix dTemp_;
+    Matrix lambdaSorted_;
+    Matrix lambda_;
+
+    double forward(int);
+    void backward();
+    void backwardStep(int);
+
+  public:
+    BatchRnn(Model&, int, int, double);
+    void reset();
+    void updateLearningRate(double);
+    double getLr();
+    double train(DataProvider&, double&);
+};
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "CacheFile.h"
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+const char CACHE_MAGIC[8] = {'C', 'R', 'N', 'N', 'C', 'A', 'C', 'H'};
+
+// token arrays start at multiples of this, a multiple of the page size
+const int64_t CACHE_ALIGNMENT = 65536;
+
+static uint64_t mix(uint64_t h, uint64_t x) {
+  h ^= x * 0x9e3779b97f4a7c15ULL;
+  h = (h << 27) | (h >> 37);
+  return h * 0xbf58476d1ce4e5b9ULL;
+}
+
+// hash of the content of a file, 8 bytes at a time
+uint64_t hashFile(std::string fname) {
+  FILE* f = fopen(fname.c_str(), "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  const int blockSize = 1 << 20;
+  std::vector<char> block(blockSize);
+  uint64_t h = 0;
+  uint64_t length = 0;
+  size_t n = 0;
+  while ((n = fread(block.data(), 1, blockSize, f)) > 0) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      uint64_t x;
+      memcpy(&x, block.data() + i, 8);
+      h = mix(h, x);
+    }
+    for (; i < n; i++) {
+      h = mix(h, (unsigned char) block[i]);
+    }
+    length += n;
+  }
+  fclose(f);
+  return mix(h, length);
+}
+
+uint64_t hashString(std::string str, uint64_t h) {
+  for (int i=0; i<str.size(); i++) {
+    h = mix(h, (unsigned char) str[i]);
+  }
+  return mix(h, str.size());
+}
+
+// hash of the contents of files in order, that of a single file is its
+// hashFile
+uint64_t hashFiles(const std::vector<std::string>& fnames) {
+  uint64_t h = hashFile(fnames[0]);
+  for (int i=1; i<fnames.size(); i++) {
+    h = mix(h, hashFile(fnames[i]));
+  }
+  return h;
+}
+
+// the cache is written to a temporary file renamed by close
+CacheWriter::CacheWriter(std::string fname, uint64_t key) {
+  fname_ = fname;
+  tmpName_ = fname + ".tmp" + std::to_string(getpid());
+  f_ = fopen(tmpName_.c_str(), "wb");
+  ok_ = (f_ != NULL);
+  if (ok_) {
+    ok_ = fwrite(CACHE_MAGIC, 1, 8, f_) == 8;
+    writeInt(CACHE_VERSION);
+    writeInt(key);
+  }
+}
+
+CacheWriter::~CacheWriter() {
+  if (f_ != NULL) {
+    fclose(f_);
+    remove(tmpName_.c_str());
+  }
+}
+
+void CacheWriter::writeInt(int64_t x) {
+  ok_ = ok_ && fwrite(&x, sizeof(int64_t), 1, f_) == 1;
+}
+
+void CacheWriter::writeInts(const std::vector<int>& x) {
+  writeInt(x.size());
+  ok_ = ok_ && fwrite(x.data(), sizeof(int), x.size(), f_) == x.size();
+}
+
+void CacheWriter::writeString(std::string str) {
+  writeInt(str.size());
+  ok_ = ok_ && fwrite(str.data(), 1, str.size(), f_) == str.size();
+}
+
+void CacheWriter::writeWString(std::wstring str) {
+  writeInt(str.size());
+  for (int i=0; i<str.size(); i++) {
+    int32_t c = str[i];
+    ok_ = ok_ && fwrite(&c, sizeof(int32_t), 1, f_) == 1;
+  }
+}
+
+// writes the number of tokens and their offset, then the padding and the
+// raw tokens
+void CacheWriter::writeTokens(TokenArray& tokens) {
+  if (!ok_) {
+    return;
+  }
+  int64_t pos = ftell(f_) + 2 * sizeof(int64_t);
+  int64_t offset = (pos + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT
+      * CACHE_ALIGNMENT;
+  writeInt(tokens.size());
+  writeInt(offset);
+  std::vector<char> padding(offset - pos, 0);
+  ok_ = ok_ && fwrite(padding.data(), 1, padding.size(), f_)
+      == padding.size();
+  ok_ = ok_ && tokens.write(f_);
+}
+
+bool CacheWriter::close() {
+  if (f_ == NULL) {
+    return false;
+  }
+  ok_ = (fclose(f_) == 0) && ok_;
+  f_ = NULL;
+  if (ok_) {
+    ok_ = rename(tmpName_.c_str(), fname_.c_str()) == 0;
+  }
+  if (!ok_) {
+    remove(tmpName_.c_str());
+  }
+  return ok_;
+}
+
+// the reader is good only if the file exists with the expected version and
+// key, and as long as all the reads succeed
+CacheReader::CacheReader(std::string fname, uint64_t key) {
+  fname_ = fname;
+  fileSize_ = 0;
+  f_ = fopen(fname.c_str(), "rb");
+  ok_ = (f_ != NULL);
+  struct stat st;
+  ok_ = ok_ && fstat(fileno(f_), &st) == 0;
+  if (ok_) {
+    fileSize_ = st.st_size;
+  }
+  char magic[8];
+  ok_ = ok_ && fread(magic, 1, 8, f_) == 8
+      && memcmp(magic, CACHE_MAGIC, 8) == 0;
+  ok_ = ok_ && readInt() == CACHE_VERSION;
+  ok_ = ok_ && (uint64_t) readInt() == key;
+}
+
+CacheReader::~CacheReader() {
+  if (f_ != NULL) {
+    fclose(f_);
+  }
+}
+
+bool CacheReader::good() {
+  return ok_;
+}
+
+// whether n items of the given size are left in the file, so that a corrupt
+// length is caught before it is allocated or read
+bool CacheReader::fits(int64_t n, int64_t size) {
+  int64_t pos = ok_ ? ftell(f_) : -1;
+  return ok_ && n >= 0 && pos >= 0 && n <= (fileSize_ - pos) / size;
+}
+
+int64_t CacheReader::readInt() {
+  int64_t x = 0;
+  ok_ = ok_ && fread(&x, sizeof(int64_t), 1, f_) == 1;
+  return x;
+}
+
+void CacheReader::readInts(std::vector<int>& x) {
+  int64_t n = readInt();
+  ok_ = fits(n, sizeof(int));
+  x.resize(ok_ ? n : 0);
+  ok_ = ok_ && fread(x.data(), sizeof(int), n, f_) == n;
+}
+
+std::string CacheReader::readString() {
+  int64_t n = readInt();
+  ok_ = fits(n, 1);
+  std::string str(ok_ ? n : 0, '\0');
+  ok_ = ok_ && fread(&str[0], 1, n, f_) == n;
+  return str;
+}
+
+std::wstring CacheReader::readWString() {
+  int64_t n = readInt();
+  ok_ = fits(n, sizeof(int32_t));
+  std::wstring str;
+  for (int64_t i=0; i<n && ok_; i++) {
+    int32_t c = 0;
+    ok_ = fread(&c, sizeof(int32_t), 1, f_) == 1;
+    str.push_back(c);
+  }
+  return str;
+}
+
+// maps the tokens in place and moves past them
+void CacheReader::readTokens(TokenArray& tokens) {
+  int64_t n = readInt();
+  int64_t offset = readInt();
+  ok_ = ok_ && n >= 0 && offset >= 0 && offset <= fileSize_
+      && n <= (fileSize_ - offset) / (int64_t) sizeof(int32_t);
+  ok_ = ok_ && tokens.mapFile(fname_, offset, n);
+  ok_ = ok_ && fseek(f_, offset + n * sizeof(int32_t), SEEK_SET) == 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef CACHEFILE_H
+#define CACHEFILE_H
+
+#include "TokenArray.h"
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+
+// Binary cache of a preprocessed corpus. The file starts with a magic, a
+// format version and the key of the corpus and options it was built from,
+// followed by the sections written by the data provider. Token arrays are
+// stored at aligned offsets so that they are memory mapped in place.
+const int CACHE_VERSION = 4;
+
+uint64_t hashFile(std::string);
+uint64_t hashFiles(const std::vector<std::string>&);
+uint64_t hashString(std::string, uint64_t);
+
+class CacheWriter {
+  private:
+    FILE* f_;
+    std::string fname_;
+    std::string tmpName_;
+    bool ok_;
+
+  public:
+    CacheWriter(std::string, uint64_t);
+    ~CacheWriter();
+    void writeInt(int64_t);
+    void writeInts(const std::vector<int>&);
+    void writeString(std::string);
+    void writeWString(std::wstring);
+    void writeTokens(TokenArray&);
+    bool close();
+};
+
+class CacheReader {
+  private:
+    FILE* f_;
+    std::string fname_;
+    int64_t fileSize_;
+    bool ok_;
+
+    bool fits(int64_t, int64_t);
+
+  public:
+    CacheReader(std::string, uint64_t);
+    ~CacheReader();
+    bool good();
+    int64_t readInt();
+    void readInts(std::vector<int>&);
+    std::string readString();
+    std::wstring readWString();
+    void readTokens(TokenArray&);
+};
+
+#endif
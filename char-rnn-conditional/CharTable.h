@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef CHARTABLE_H
+#define CHARTABLE_H
+
+#include <vector>
+
+// Two way map between the chars of a corpus and their ids, given in order
+// of insertion. The ids of the chars of the basic multilingual plane are
+// read directly from an array indexed by the char, the few others are kept
+// in a small open addressing table.
+class CharTable {
+  private:
+    std::vector<int> bmp_;
+    std::vector<wchar_t> astralKeys_;
+    std::vector<int> astralIds_;
+    int nAstral_;
+    std::vector<wchar_t> chars_;
+
+    int findAstral(wchar_t) const;
+    void growAstral();
+
+  public:
+    CharTable();
+    int size() const;
+    int getId(wchar_t) const;
+    int addChar(wchar_t);
+    wchar_t getChar(int) const;
+};
+
+#endif
@@ -8,12 +8,31 @@
  */
 
 #include "DataProvider.h"
+#include "Utf8.h"
 #include <iostream>
 #include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <sys/stat.h>
 
 DataProvider::DataProvider(int ngramOrder, int minFreq) {
-  currIdx_ = tokens_.begin();
+  currIdx_ = 0;
   nWords_ = 1;
+  nThreads_ = 1;
+  ngramError_ = 0.0;
+  checkNgrams_ = false;
+  historyBudget_ = 0.0;
+  nhid_ = 0;
+  cacheKey_ = 0;
+  streamChunk_ = 0;
+  packing_ = false;
+  loadBytes_ = 0;
+  loadSeconds_ = 0.0;
   ngramOrder_ = ngramOrder;
   minFreq_ = minFreq;
 }
@@ -21,6 +40,86 @@ DataProvider::DataProvider(int ngramOrder, int minFreq) {
 DataProvider::~DataProvider() {
 }
 
+// number of threads used to decode the training files and count their
+// ngrams
+void DataProvider::setNumThreads(int nThreads) {
+  nThreads_ = std::max(nThreads, 1);
+}
+
+// approximate the ngram counts with lossy counting of parameter epsilon,
+// optionally comparing the selected ngrams with exact counting
+void DataProvider::setLossyCounting(double epsilon, bool check) {
+  ngramError_ = epsilon;
+  checkNgrams_ = check;
+}
+
+// limits the valid histories to the most frequent ones whose output
+// parameters and gradients (2 x numChars x nhid doubles each) fit in budget
+// bytes, nhid is also used to report the size of the history table
+void DataProvider::setHistoryBudget(double budget, int nhid) {
+  historyBudget_ = budget;
+  nhid_ = nhid;
+}
+
+// directory where the preprocessed corpora are cached, none if empty
+void DataProvider::setCacheDir(std::string cacheDir) {
+  cacheDir_ = cacheDir;
+}
+
+// streams the tokens by chunks of chunkSize tokens instead of keeping them
+// in memory, 0 to disable
+void DataProvider::setStreaming(size_t chunkSize) {
+  streamChunk_ = chunkSize;
+  tokens_.setChunkSize(chunkSize);
+}
+
+// bit-packs the tokens kept in memory to as many bits as the largest id
+// needs, as they are read
+void DataProvider::setPacking(bool packing) {
+  packing_ = packing;
+}
+
+// spools the tokens of a streamed corpus next to it, the others are kept in
+// memory, packed as they are read when packing is set
+bool DataProvider::startSpool(std::string fname) {
+  if (streamChunk_ > 0) {
+    if (tokens_.openSpool(fname + ".tok")) {
+      return true;
+    }
+    fprintf(stderr, "Could not create %s.tok, reading %s in memory\n",
+        fname.c_str(), fname.c_str());
+    tokens_.setChunkSize(0);
+  }
+  if (packing_) {
+    tokens_.pack();
+  }
+  return false;
+}
+
+void DataProvider::endSpool(std::string fname) {
+  if (!tokens_.closeSpool()) {
+    fprintf(stderr, "Could not write %s.tok\n", fname.c_str());
+    exit(1);
+  }
+}
+
+// accounts for the bytes decoded since tic
+void DataProvider::addLoadTime(size_t nBytes,
+    std::chrono::steady_clock::time_point tic) {
+  auto toc = std::chrono::steady_clock::now();
+  loadBytes_ += nBytes;
+  loadSeconds_ += std::chrono::duration_cast<std::chrono::microseconds>
+      (toc - tic).count() / 1e6;
+}
+
+// speed of the decoding of the corpus files, in MB per second
+double DataProvider::getLoadSpeed() {
+  if (loadSeconds_ <= 0.0) {
+    return 0.0;
+  }
+  return loadBytes_ / (1024.0 * 1024.0) / loadSeconds_;
+}
+
 int DataProvider::getNumTokens() {
   return tokens_.size();
 }
@@ -30,46 +129,51 @@ int DataProvider::getNumWords() {
 }
 
 int DataProvider::getNumChars() {
-  return char2int_.size();
+  return vocab_->getNumChars();
+}
+
+int DataProvider::getNumValidNgrams() {
+  return vocab_->getNumNgrams();
 }
 
 void DataProvider::printCharTable() {
   char mbs[16];
   int nBytes;
-  for (auto it = char2int_.begin(); it != char2int_.end(); ++it) {
-    nBytes = wctomb(mbs, it->first);
-    printf("%lc : %x : %d : ", it->first, it->first, it->second);
-    for (int i=0; i<nBytes; i++) {
-      printf("%x ", 0xff & mbs[i]);
+  for (int i=0; i<vocab_->getNumChars(); i++) {
+    wchar_t c = vocab_->getChar(i);
+    nBytes = encodeUtf8(c, mbs);
+    printf("%lc : %x : %d : ", c, c, i);
+    for (int j=0; j<nBytes; j++) {
+      printf("%x ", 0xff & mbs[j]);
     }
     printf("\n");
   }
 }
 
 void DataProvider::printDictionary() {
-  for (auto it = char2int_.begin(); it != char2int_.end(); ++it) {
-    std::cout << it->first << " -> " << it->second << std::endl;
+  for (int i=0; i<vocab_->getNumChars(); i++) {
+    std::cout << vocab_->getChar(i) << " -> " << i << std::endl;
   }
 }
 
 void DataProvider::printTokens() {
-  for (auto it = tokens_.begin(); it != tokens_.end(); ++it) {
-    std::cout << *it << std::endl;
+  for (size_t i=0; i<tokens_.size(); i++) {
+    std::cout << tokens_.get(i) << std::endl;
   }
 }
 
 wchar_t DataProvider::getChar(int x) {
-  return int2char_[x];
+  return vocab_->getChar(x);
 }
 
 void DataProvider::initIterator() {
-  currIdx_ = tokens_.begin();
+  currIdx_ = 0;
 }
 
 void DataProvider::getToken(int& now, int& next) {
-  now = *currIdx_;
+  now = tokens_.get(currIdx_);
 
-  history_.push_back(int2char_[now]);
+  history_.push_back(vocab_->getChar(now));
   if (history_.size() > ngramOrder_) {
     history_.erase(0, 1);
   }
@@ -82,16 +186,35 @@ void DataProvider::getToken(int& now, int& next) {
   // printf("\n");
 
   currIdx_++;
-  if (currIdx_ == tokens_.end()) {
-    currIdx_ = tokens_.begin();
+  if (currIdx_ == tokens_.size()) {
+    currIdx_ = 0;
   }
-  next = *currIdx_;
+  next = tokens_.get(currIdx_);
 }
 
 std::wstring DataProvider::getHistory() {
-  std::wstring res = history_;
+  return getHistory(history_);
+}
+
+// a cursor over the tokens [begin, end), the chars read through it are
+// appended to the history given with each token
+TokenCursor DataProvider::getCursor(size_t begin, size_t end) {
+  return TokenCursor(tokens_, begin, end);
+}
+
+void DataProvider::getToken(TokenCursor& cursor, int& now, int& next,
+                            std::wstring& history) {
+  cursor.next(now, next);
+  history.push_back(vocab_->getChar(now));
+  if (history.size() > ngramOrder_) {
+    history.erase(0, 1);
+  }
+}
+
+// the longest suffix of a history that is a valid ngram
+std::wstring DataProvider::getHistory(std::wstring res) {
   while (res.length()>0) {
-    if (validNgrams_.count(res)==0) {
+    if (!vocab_->isValidNgram(res)) {
       res.erase(0, 1);
     } else {
       break;
@@ -101,72 +224,484 @@ std::wstring DataProvider::getHistory() {
   return res;
 }
 
-void DataProvider::readFromFile(std::string fname) {
-  std::locale::global(std::locale(""));
-  std::wifstream ifs(fname);
-  wchar_t c;
-  int k = 0;
+// builds the string of a node of the ngram tree
+std::wstring DataProvider::getNgram(const Vocabulary& vocab,
+                                    NgramCounter& counter, int node) {
+  std::vector<int> ngram;
+  counter.getNgram(node, ngram);
+  std::wstring str;
+  for (int j=0; j<ngram.size(); j++) {
+    str.push_back(vocab.getChar(ngram[j]));
+  }
+  return str;
+}
 
-  std::unordered_map<std::wstring, int> ngramCount;
+// counts the windows ending at the tokens [begin, end), decoded by blocks
+// that overlap by the ngramOrder - 1 tokens starting a window
+static void countWindows(TokenArray* tokens, int ngramOrder, size_t begin,
+                         size_t end, NgramCounter* counter) {
+  const size_t blockSize = 4096;
+  int first = ngramOrder - 1;
+  std::vector<int32_t> block;
+  for (size_t i=begin; i<end; i+=blockSize) {
+    size_t n = std::min(blockSize, end - i);
+    block.resize(first + n);
+    tokens->read(i - first, first + n, block.data());
+    counter->addWindows(block.data(), first, first + n);
+  }
+}
 
-  std::wstring ngramHistory;
+// counts the suffixes of every ngram window over the tokens, the windows
+// are split in contiguous shards counted in parallel and then merged in
+// shard order into counter
+void DataProvider::countNgrams(double epsilon, NgramCounter& counter) {
+  int first = ngramOrder_ - 1;
+  size_t nWindows = tokens_.size() > first ? tokens_.size() - first : 0;
+  int nShards = std::max((int) std::min((size_t) nThreads_, nWindows), 1);
+  std::vector<NgramCounter> shards(nShards - 1,
+      NgramCounter(ngramOrder_, epsilon));
+  std::vector<std::thread> workers;
+  for (int s=0; s<nShards; s++) {
+    size_t begin = first + nWindows * s / nShards;
+    size_t end = first + nWindows * (s + 1) / nShards;
+    NgramCounter* shard = (s == 0) ? &counter : &shards[s - 1];
+    workers.push_back(std::thread(countWindows, &tokens_, ngramOrder_,
+          begin, end, shard));
+  }
+  for (int s=0; s<nShards; s++) {
+    workers[s].join();
+  }
+  for (int s=1; s<nShards; s++) {
+    counter.merge(shards[s - 1]);
+  }
+}
 
-  while (ifs.get(c)) {
-    if (c == '_') {
-      nWords_++;
+// counts the ngram windows of a streamed corpus in a single sequential pass
+void DataProvider::countStreamedNgrams(NgramCounter& counter) {
+  std::vector<int> window(ngramOrder_);
+  for (size_t i=0; i<tokens_.size(); i++) {
+    for (int j=1; j<ngramOrder_; j++) {
+      window[j - 1] = window[j];
     }
-    if (char2int_.count(c)==0) {
-      char2int_.insert({c, k});
-      int2char_.insert({k, c});
-      tokens_.push_back(k);
-      k++;
-    } else {
-      int idx = char2int_[c];
-      tokens_.push_back(idx);
+    window[ngramOrder_ - 1] = tokens_.get(i);
+    if (i + 1 >= ngramOrder_) {
+      counter.addWindow(window.data());
     }
+  }
+}
+
+// name of the cache of a corpus, unique for its content and options
+std::string DataProvider::getCachePath(std::string fname) {
+  size_t slash = fname.find_last_of('/');
+  std::string base = (slash == std::string::npos) ?
+      fname : fname.substr(slash + 1);
+  char key[32];
+  snprintf(key, sizeof(key), "%016llx", (unsigned long long) cacheKey_);
+  return cacheDir_ + "/" + base + "." + key + ".cache";
+}
+
+// the training cache holds the vocabulary and the file offsets, the
+// validation and test caches only their tokens
+bool DataProvider::saveCache(std::string path, bool isTrain) {
+  CacheWriter cache(path, cacheKey_);
+  cache.writeInt(nWords_);
+  if (isTrain) {
+    vocab_->write(cache);
+    cache.writeInt(fileOffsets_.size());
+    for (int i=0; i<fileOffsets_.size(); i++) {
+      cache.writeInt(fileOffsets_[i]);
+    }
+  }
+  cache.writeTokens(tokens_);
+  return cache.close();
+}
+
+bool DataProvider::loadCache(std::string path, bool isTrain) {
+  CacheReader cache(path, cacheKey_);
+  int64_t nWords = cache.readInt();
+  std::shared_ptr<Vocabulary> vocab = std::make_shared<Vocabulary>();
+  std::vector<size_t> offsets;
+  if (isTrain) {
+    if (!vocab->read(cache)) {
+      return false;
+    }
+    int nFiles = cache.readInt();
+    for (int i=0; i<nFiles && cache.good(); i++) {
+      offsets.push_back(cache.readInt());
+    }
+  }
+  cache.readTokens(tokens_);
+  if (!cache.good() || nWords < 1 || nWords > tokens_.size() + 1 ||
+      (isTrain && (offsets.empty() || offsets.back() != tokens_.size()
+      || !std::is_sorted(offsets.begin(), offsets.end())))) {
+    tokens_.clear();
+    return false;
+  }
+  // the tokens of the cache are mapped, they are packed from its pages
+  if (packing_) {
+    tokens_.pack();
+  }
+
+  nWords_ = nWords;
+  if (isTrain) {
+    vocab_ = vocab;
+    fileOffsets_.swap(offsets);
+  }
+  std::cout << "Loaded cache " << path << std::endl;
+  return true;
+}
+
+// a training file decoded by a worker thread, newChars holds its chars in
+// the order of their first occurrence in the file
+struct FileShard {
+  std::vector<wchar_t> chars;
+  std::vector<wchar_t> newChars;
+  int nWords;
+  size_t nBytes;
+};
+
+// the files decoded by the workers and merged in file order by the caller,
+// a file being decoded at most window files ahead of the merged ones so
+// that only a few shards are held at once
+struct FileQueue {
+  const std::vector<std::string>* fnames;
+  std::vector<FileShard> shards;
+  std::vector<bool> ready;
+  int next;
+  int merged;
+  int window;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+// the next file to decode, -1 when none is left
+static int nextFile(FileQueue* queue) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  queue->cv.wait(lock, [queue] {
+      return queue->next >= queue->fnames->size()
+          || queue->next < queue->merged + queue->window;
+  });
+  if (queue->next >= queue->fnames->size()) {
+    return -1;
+  }
+  return queue->next++;
+}
+
+// waits for file i to be decoded
+static FileShard& waitFile(FileQueue* queue, int i) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  queue->cv.wait(lock, [queue, i] { return queue->ready[i]; });
+  return queue->shards[i];
+}
 
-    // updating the ngram history
-    ngramHistory.push_back(c);
-    if (ngramHistory.length() > ngramOrder_) {
-      ngramHistory.erase(0, 1);
+// frees the shard of file i once merged, letting the workers go on
+static void releaseFile(FileQueue* queue, int i) {
+  queue->shards[i] = FileShard();
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  queue->merged = i + 1;
+  queue->cv.notify_all();
+}
+
+// decodes the files of the queue taken in turn until none is left
+static void decodeShards(FileQueue* queue) {
+  CharTable seen;
+  std::vector<int> lastFile;
+  std::vector<wchar_t> block;
+  int i;
+  while ((i = nextFile(queue)) >= 0) {
+    FileShard& shard = queue->shards[i];
+    shard.nWords = 0;
+    Utf8Reader reader((*queue->fnames)[i]);
+    while (reader.read(block) > 0) {
+      for (size_t j=0; j<block.size(); j++) {
+        wchar_t c = block[j];
+        int id = seen.addChar(c);
+        if (id == lastFile.size()) {
+          lastFile.push_back(-1);
+        }
+        if (lastFile[id] != i) {
+          lastFile[id] = i;
+          shard.newChars.push_back(c);
+        }
+        if (c == '_') {
+          shard.nWords++;
+        }
+      }
+      shard.chars.insert(shard.chars.end(), block.begin(), block.end());
     }
-    if (ngramHistory.length() == ngramOrder_) {
-      for (int j=0; j<ngramOrder_; j++) {
+    shard.nBytes = reader.getNumBytes();
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->ready[i] = true;
+    queue->cv.notify_all();
+  }
+}
 
-        std::wstring temp = ngramHistory.substr(j, ngramOrder_-j);
-        if (ngramCount.count(temp) == 0) {
-          ngramCount.insert({temp, 1});
-        } else {
-          ngramCount[temp]++;
+// decodes the files one after the other, returns the number of bytes read
+size_t DataProvider::readFiles(const std::vector<std::string>& fnames,
+                               Vocabulary& vocab) {
+  size_t nBytes = 0;
+  std::vector<wchar_t> chars;
+  for (int i=0; i<fnames.size(); i++) {
+    Utf8Reader reader(fnames[i]);
+    while (reader.read(chars) > 0) {
+      for (size_t j=0; j<chars.size(); j++) {
+        wchar_t c = chars[j];
+        if (c == '_') {
+          nWords_++;
         }
+        tokens_.push_back(vocab.addChar(c));
       }
     }
+    nBytes += reader.getNumBytes();
+    fileOffsets_.push_back(tokens_.size());
   }
+  return nBytes;
+}
 
-  for (auto it=ngramCount.begin(); it!=ngramCount.end(); ++it) {
-    if (it->first.size()==1 || it->second > minFreq_) {
-      validNgrams_.insert(it->first);
+// decodes the files in parallel, one file per thread at a time, while they
+// are merged in file order so that the chars get the ids of a serial read
+size_t DataProvider::decodeFiles(const std::vector<std::string>& fnames,
+                                 Vocabulary& vocab) {
+  int nWorkers = std::min(nThreads_, (int) fnames.size());
+  FileQueue queue;
+  queue.fnames = &fnames;
+  queue.shards.resize(fnames.size());
+  queue.ready.assign(fnames.size(), false);
+  queue.next = 0;
+  queue.merged = 0;
+  queue.window = 2 * nWorkers;
+  std::vector<std::thread> workers;
+  for (int w=0; w<nWorkers; w++) {
+    workers.push_back(std::thread(decodeShards, &queue));
+  }
+
+  // there are at most as many chars as bytes, reserving them saves the
+  // copies of a growing array and its pages past the last char are never
+  // touched, packed tokens grow instead
+  size_t nFileBytes = 0;
+  for (int i=0; i<fnames.size(); i++) {
+    struct stat st;
+    if (stat(fnames[i].c_str(), &st) == 0) {
+      nFileBytes += st.st_size;
+    }
+  }
+  tokens_.reserve(tokens_.size() + nFileBytes);
+
+  size_t nBytes = 0;
+  for (int i=0; i<fnames.size(); i++) {
+    FileShard& shard = waitFile(&queue, i);
+    for (int j=0; j<shard.newChars.size(); j++) {
+      vocab.addChar(shard.newChars[j]);
+    }
+    for (size_t j=0; j<shard.chars.size(); j++) {
+      tokens_.push_back(vocab.getId(shard.chars[j]));
     }
+    nWords_ += shard.nWords;
+    nBytes += shard.nBytes;
+    fileOffsets_.push_back(tokens_.size());
+    releaseFile(&queue, i);
   }
-  std::cout << validNgrams_.size() << std::endl;
-  ifs.close();
+  for (int w=0; w<nWorkers; w++) {
+    workers[w].join();
+  }
+  return nBytes;
+}
+
+// the files are read as a single corpus, their tokens following each other
+// in the given order
+void DataProvider::readFromFile(const std::vector<std::string>& fnames) {
+  // the cache depends on everything that changes the valid ngrams
+  std::string cachePath;
+  if (!cacheDir_.empty()) {
+    char options[256];
+    snprintf(options, sizeof(options),
+        "train ngram=%d minFreq=%d ngramError=%g threads=%d budget=%g nhid=%d",
+        ngramOrder_, minFreq_, ngramError_,
+        ngramError_ > 0.0 && streamChunk_ == 0 ? nThreads_ : 1,
+        historyBudget_, nhid_);
+    cacheKey_ = hashString(options, hashFiles(fnames));
+    cachePath = getCachePath(fnames[0]);
+    if (loadCache(cachePath, true)) {
+      std::cout << vocab_->getNumNgrams() << std::endl;
+      return;
+    }
+  }
+
+  // a streamed corpus is spooled as it is decoded and its ngrams are
+  // counted by reading it back, serially
+  bool streaming = startSpool(fnames[0]);
+  auto tic = std::chrono::steady_clock::now();
+  std::shared_ptr<Vocabulary> vocab = std::make_shared<Vocabulary>();
+  fileOffsets_.assign(1, 0);
+  size_t nBytes;
+  if (streaming || fnames.size() == 1) {
+    nBytes = readFiles(fnames, *vocab);
+  } else {
+    nBytes = decodeFiles(fnames, *vocab);
+  }
+  if (streaming) {
+    endSpool(fnames[0]);
+  }
+  addLoadTime(nBytes, tic);
+
+  NgramCounter ngramCount(ngramOrder_, ngramError_);
+  if (streaming) {
+    countStreamedNgrams(ngramCount);
+  } else {
+    countNgrams(ngramError_, ngramCount);
+  }
+
+  // with lossy counting count + delta bounds the true count from above, so
+  // no ngram above minFreq_ is missed, the uncertain ones might be extra
+  std::vector<int> unigrams;
+  std::vector<int> candidates;
+  for (int i=1; i<ngramCount.getNumNodes(); i++) {
+    if (ngramCount.getDepth(i)==1) {
+      unigrams.push_back(i);
+    } else if (ngramCount.getCount(i) + ngramCount.getDelta(i) > minFreq_) {
+      candidates.push_back(i);
+    }
+  }
+
+  // keeping only the most frequent histories that fit in the memory budget,
+  // shorter ngrams first on ties so that the suffixes of a kept history are
+  // kept too
+  long long historyBytes = 2LL * vocab->getNumChars() * nhid_ *
+      sizeof(double);
+  if (historyBudget_ > 0.0) {
+    long long maxHistories = (long long) (historyBudget_ / historyBytes);
+    maxHistories = std::max(maxHistories - (long long) unigrams.size(), 0LL);
+    if (candidates.size() > maxHistories) {
+      std::sort(candidates.begin(), candidates.end(),
+          [&ngramCount](int a, int b) {
+        int countA = ngramCount.getCount(a) + ngramCount.getDelta(a);
+        int countB = ngramCount.getCount(b) + ngramCount.getDelta(b);
+        if (countA != countB) {
+          return countA > countB;
+        }
+        if (ngramCount.getDepth(a) != ngramCount.getDepth(b)) {
+          return ngramCount.getDepth(a) < ngramCount.getDepth(b);
+        }
+        return a < b;
+      });
+      candidates.resize(maxHistories);
+    }
+  }
+
+  for (int i=0; i<unigrams.size(); i++) {
+    vocab->addNgram(getNgram(*vocab, ngramCount, unigrams[i]));
+  }
+  int nUncertain = 0;
+  for (int i=0; i<candidates.size(); i++) {
+    vocab->addNgram(getNgram(*vocab, ngramCount, candidates[i]));
+    if (ngramCount.getCount(candidates[i]) <= minFreq_) {
+      nUncertain++;
+    }
+  }
+
+  if (nhid_ > 0) {
+    printf("history table: %d histories, %.1f MB for U and gU",
+        vocab->getNumNgrams(),
+        vocab->getNumNgrams() * historyBytes / (1024.0 * 1024.0));
+    if (historyBudget_ > 0.0) {
+      printf(" (budget %.1f MB)", historyBudget_ / (1024.0 * 1024.0));
+    }
+    printf("\n");
+  }
+
+  if (ngramError_ > 0.0) {
+    printf("lossy ngram counting: epsilon=%g windows=%lld nodes=%d ",
+        ngramError_, ngramCount.getNumWindows(), ngramCount.getNumNodes());
+    printf("error bound=%d uncertain ngrams=%d\n",
+        ngramCount.getErrorBound(), nUncertain);
+    if (checkNgrams_) {
+      NgramCounter exactCount(ngramOrder_);
+      if (streaming) {
+        countStreamedNgrams(exactCount);
+      } else {
+        countNgrams(0.0, exactCount);
+      }
+      int nExact = 0;
+      int nMissing = 0;
+      for (int i=1; i<exactCount.getNumNodes(); i++) {
+        if (exactCount.getDepth(i)==1 || exactCount.getCount(i) > minFreq_) {
+          nExact++;
+          if (!vocab->isValidNgram(getNgram(*vocab, exactCount, i))) {
+            nMissing++;
+          }
+        }
+      }
+      printf("exact ngram counting: %d valid ngrams, lossy counting added %d",
+          nExact, vocab->getNumNgrams() - nExact + nMissing);
+      printf(" and missed %d\n", nMissing);
+    }
+  }
+  std::cout << vocab->getNumNgrams() << std::endl;
+
+  // the vocabulary is complete, it is not modified any more
+  vocab_ = vocab;
+
+  if (!cacheDir_.empty() && !saveCache(cachePath, true)) {
+    fprintf(stderr, "Could not write cache %s\n", cachePath.c_str());
+  }
+}
+
+// moves the tokens to a memory mapped file, shared with other processes
+// mapping the same file
+bool DataProvider::mapTokens(std::string fname) {
+  return tokens_.moveToFile(fname);
+}
+
+// number of bits per packed token, 0 when the tokens are not packed
+int DataProvider::getTokenBits() {
+  return tokens_.getBits();
 }
 
 void DataProvider::readFromFile(std::string fname, DataProvider& train) {
-  char2int_ = train.char2int_;
-  int2char_ = train.int2char_;
-  validNgrams_ = train.validNgrams_;
-
-  std::wifstream ifs(fname);
-  wchar_t c;
-  int k = 0;
-  while (ifs.get(c)) {
-    if (char2int_.count(c)==0) {
-      std::cout << "oh!" << std::endl;
-    } else {
-      int idx = char2int_[c];
-      tokens_.push_back(idx);
+  vocab_ = train.vocab_;
+
+  // the tokens depend on the char table of the training corpus
+  std::string cachePath;
+  if (!cacheDir_.empty()) {
+    cacheKey_ = hashString("eval", hashFile(fname) ^ train.cacheKey_);
+    cachePath = getCachePath(fname);
+    if (loadCache(cachePath, false)) {
+      return;
+    }
+  }
+
+  bool streaming = startSpool(fname);
+  auto tic = std::chrono::steady_clock::now();
+  Utf8Reader reader(fname);
+  std::vector<wchar_t> chars;
+  while (reader.read(chars) > 0) {
+    for (size_t j=0; j<chars.size(); j++) {
+      wchar_t c = chars[j];
+      int idx = vocab_->getId(c);
+      if (idx < 0) {
+        std::cout << "oh!" << std::endl;
+      } else {
+        tokens_.push_back(idx);
+      }
     }
   }
-  ifs.close();
+  if (streaming) {
+    endSpool(fname);
+  }
+  addLoadTime(reader.getNumBytes(), tic);
+
+  if (!cacheDir_.empty() && !saveCache(cachePath, false)) {
+    fprintf(stderr, "Could not write cache %s\n", cachePath.c_str());
+  }
+}
+
+// the first token of each training file followed by the number of tokens,
+// the tokens of file i are [offsets[i], offsets[i + 1])
+const std::vector<size_t>& DataProvider::getFileOffsets() {
+  return fileOffsets_;
+}
+
+// the vocabulary of the training corpus, shared by all the providers
+std::shared_ptr<const Vocabulary> DataProvider::getVocabulary() {
+  return vocab_;
 }
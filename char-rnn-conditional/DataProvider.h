@@ -12,29 +12,66 @@
 
 #include <unordered_map>
 #include <string>
-#include <unordered_set>
-#include <list>
 #include <fstream>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include "NgramCounter.h"
+#include "TokenArray.h"
+#include "CacheFile.h"
+#include "Vocabulary.h"
 
 class DataProvider {
   private:
-    std::unordered_map<wchar_t, int> char2int_;
-    std::unordered_map<int, wchar_t> int2char_;
-    std::list<int> tokens_;
-    std::list<int>::iterator currIdx_;
+    std::shared_ptr<const Vocabulary> vocab_;
+    TokenArray tokens_;
+    size_t currIdx_;
     int nWords_;
+    int nThreads_;
+    double ngramError_;
+    bool checkNgrams_;
+    double historyBudget_;
+    int nhid_;
+    std::string cacheDir_;
+    uint64_t cacheKey_;
+    size_t streamChunk_;
+    bool packing_;
+    size_t loadBytes_;
+    double loadSeconds_;
     std::wstring history_;
-    std::unordered_set<std::wstring> validNgrams_;
+
+    // index of the first token of each training file, then the number of
+    // tokens
+    std::vector<size_t> fileOffsets_;
+
+    std::wstring getNgram(const Vocabulary&, NgramCounter&, int);
+    void countNgrams(double, NgramCounter&);
+    void countStreamedNgrams(NgramCounter&);
+    size_t readFiles(const std::vector<std::string>&, Vocabulary&);
+    size_t decodeFiles(const std::vector<std::string>&, Vocabulary&);
+    bool startSpool(std::string);
+    void endSpool(std::string);
+    void addLoadTime(size_t, std::chrono::steady_clock::time_point);
+    std::string getCachePath(std::string);
+    bool loadCache(std::string, bool);
+    bool saveCache(std::string, bool);
 
   public:
     int ngramOrder_;
     int minFreq_;
     DataProvider(int, int);
     ~DataProvider();
+    void setNumThreads(int);
+    void setLossyCounting(double, bool);
+    void setHistoryBudget(double, int);
+    void setCacheDir(std::string);
+    void setStreaming(size_t);
+    void setPacking(bool);
+    double getLoadSpeed();
     int getNumTokens();
     int getNumWords();
     int getNumChars();
-    int addChar(wchar_t);
+    int getNumValidNgrams();
     wchar_t getChar(int);
     void printCharTable();
     void printDictionary();
@@ -42,8 +79,15 @@ class DataProvider {
     void initIterator();
     void getToken(int&, int&);
     std::wstring getHistory();
-    void readFromFile(std::string);
+    TokenCursor getCursor(size_t, size_t);
+    void getToken(TokenCursor&, int&, int&, std::wstring&);
+    std::wstring getHistory(std::wstring);
+    void readFromFile(const std::vector<std::string>&);
     void readFromFile(std::string, DataProvider&);
+    bool mapTokens(std::string);
+    int getTokenBits();
+    const std::vector<size_t>& getFileOffsets();
+    std::shared_ptr<const Vocabulary> getVocabulary();
 };
 
 #endif
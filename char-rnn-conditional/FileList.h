@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FILELIST_H
+#define FILELIST_H
+
+#include <string>
+#include <vector>
+
+// Expands a comma separated list of paths and glob patterns into the files
+// it names, the matches of a pattern sorted by name. The files are then
+// kept in the "given" order, sorted by "name", or shuffled from a seed.
+bool isFileOrder(std::string);
+std::vector<std::string> listFiles(std::string, std::string, int);
+
+#endif
@@ -11,10 +11,15 @@
 #include "Vector.h"
 #include "Model.h"
 #include "Rnn.h"
+#include "BatchRnn.h"
 #include "DataProvider.h"
 #include "WordModule.h"
 #include "Utils.h"
+#include "FileList.h"
 #include <iostream>
+#include <locale>
+#include <memory>
+#include <algorithm>
 #include <time.h>
 #include <string.h>
 #include <float.h>
@@ -42,9 +47,20 @@ int main(int argc, char** argv) {
   int ngram = 30;
   int minFreq = 40;
   int nepoch = 10;
+  int nThreads = 1;
+  int batch = 1;
+  double ngramError = 0.0;
+  bool ngramCheck = false;
+  double historyBudget = 0.0;
+  bool mmapTokens = false;
+  bool packTokens = false;
+  long long streamChunk = 0;
+  std::string cacheDir;
   double lr = 0.1;
   double shrinkVal = 2.0;
   std::string trainFile;
+  std::string fileOrder = "given";
+  int fileSeed = 1;
   std::string validFile;
   std::string testFile;
   char init[100];
@@ -69,6 +85,21 @@ int main(int argc, char** argv) {
       std::string stemp(argv[ai+1]);
       trainFile = stemp;
     }
+    else if( strcmp( argv[ai], "--fileOrder") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n", argv[ai]);
+        return - 1;
+      }
+      std::string stemp(argv[ai+1]);
+      fileOrder = stemp;
+    }
+    else if( strcmp( argv[ai], "--fileSeed") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n", argv[ai]);
+        return - 1;
+      }
+      fileSeed = atoi(argv[ai+1]);
+    }
     else if( strcmp( argv[ai], "--validFile") == 0){
       if (ai + 1 >= argc) {
         printf("error need argument for option %s\n", argv[ai]);
@@ -120,6 +151,77 @@ int main(int argc, char** argv) {
       }
       nepoch = atoi(argv[ai+1]);
     }
+    else if( strcmp( argv[ai], "--threads") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      nThreads = atoi(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--batch") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n", argv[ai]);
+        return - 1;
+      }
+      batch = atoi(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--blas") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n", argv[ai]);
+        return - 1;
+      }
+      USE_BLAS = strcmp(argv[ai+1], "true")==0;
+    }
+    else if( strcmp( argv[ai], "--ngramError") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      ngramError = atof(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--ngramCheck") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      ngramCheck = strcmp(argv[ai+1], "true")==0;
+    }
+    else if( strcmp( argv[ai], "--historyBudget") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      historyBudget = atof(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--streamChunk") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      streamChunk = atoll(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--mmapTokens") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      mmapTokens = strcmp(argv[ai+1], "true")==0;
+    }
+    else if( strcmp( argv[ai], "--packTokens") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      packTokens = strcmp(argv[ai+1], "true")==0;
+    }
+    else if( strcmp( argv[ai], "--cacheDir") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      std::string stemp(argv[ai+1]);
+      cacheDir = stemp;
+    }
     else if( strcmp( argv[ai], "--lr") == 0){
       if (ai + 1 >= argc) {
         printf("error need argument for option %s\n",argv[ai]);
@@ -145,15 +247,65 @@ int main(int argc, char** argv) {
     fprintf(stderr, "Pleas provide training, validation and test files!\n");
     return -1;
   }
+  // packed tokens are private to the process, mapped ones are shared
+  if (packTokens && mmapTokens) {
+    fprintf(stderr, "--packTokens and --mmapTokens are exclusive!\n");
+    return -1;
+  }
+  if (!isFileOrder(fileOrder)) {
+    fprintf(stderr, "Unknown file order %s!\n", fileOrder.c_str());
+    return -1;
+  }
 
+  // the training corpus can be split in several files, given as a comma
+  // separated list of paths and glob patterns
+  std::vector<std::string> trainFiles = listFiles(trainFile, fileOrder,
+                                                  fileSeed);
+  if (trainFiles.empty()) {
+    fprintf(stderr, "No training file in %s!\n", trainFile.c_str());
+    return -1;
+  }
   DataProvider dp_train(ngram, minFreq);
   DataProvider dp_valid(ngram, minFreq);
   DataProvider dp_test(ngram, minFreq);
 
-  dp_train.readFromFile(trainFile);
+  dp_train.setNumThreads(nThreads);
+  dp_train.setLossyCounting(ngramError, ngramCheck);
+  // the budget is given in GB
+  dp_train.setHistoryBudget(historyBudget * 1024 * 1024 * 1024, nhid);
+  dp_train.setCacheDir(cacheDir);
+  dp_valid.setCacheDir(cacheDir);
+  dp_test.setCacheDir(cacheDir);
+  dp_train.setStreaming(streamChunk);
+  dp_valid.setStreaming(streamChunk);
+  dp_test.setStreaming(streamChunk);
+  // the tokens in memory are bit-packed as they are read and decoded by
+  // blocks
+  dp_train.setPacking(packTokens);
+  dp_valid.setPacking(packTokens);
+  dp_test.setPacking(packTokens);
+  // the corpora are decoded without the locale, it is only used for printing
+  std::locale::global(std::locale(""));
+  dp_train.readFromFile(trainFiles);
   dp_valid.readFromFile(validFile, dp_train);
   dp_test.readFromFile(testFile, dp_train);
 
+  // the token files are written next to the corpus files, streamed tokens
+  // are already read from there
+  if (mmapTokens && streamChunk == 0) {
+    if (!dp_train.mapTokens(trainFiles[0] + ".tok")
+        || !dp_valid.mapTokens(validFile + ".tok")
+        || !dp_test.mapTokens(testFile + ".tok")) {
+      fprintf(stderr, "Could not memory map the token files!\n");
+      return -1;
+    }
+  }
+
+  if (dp_train.getTokenBits() > 0) {
+    printf("packed training tokens: %d bits per token\n",
+        dp_train.getTokenBits());
+  }
+
 
   int numChars = dp_train.getNumChars();
   int numWords = dp_train.getNumWords();
@@ -164,10 +316,17 @@ int main(int argc, char** argv) {
   // initializing the model parameters
   Model model(nhid, numChars);
   model.initialize(init);
+  model.reserveHistories(dp_train.getNumValidNgrams());
   model.resetGradients();
 
-  // creating a network
+  // creating a network, with a batch the streams are trained together and
+  // the network is only used for evaluation
   Rnn network(model, bptt, lr);
+  batch = std::max(std::min(batch, numTrainTokens), 1);
+  std::unique_ptr<BatchRnn> batchNetwork;
+  if (batch > 1) {
+    batchNetwork.reset(new BatchRnn(model, batch, bptt, lr));
+  }
 
   double train_time = 0.0;
   double train_entropy = 0.0;
@@ -177,7 +336,11 @@ int main(int argc, char** argv) {
   double entropy_thresh = 0.001;
   bool doShrink = false;
   for (int e=0; e<nepoch; e++) {
-    train_entropy = network.train(dp_train, train_time);
+    if (batchNetwork) {
+      train_entropy = batchNetwork->train(dp_train, train_time);
+    } else {
+      train_entropy = network.train(dp_train, train_time);
+    }
     valid_entropy = network.eval(dp_valid);
     test_entropy = network.eval(dp_test);
 
@@ -185,12 +348,16 @@ int main(int argc, char** argv) {
     printf("\"nhid\": %d, ", nhid);
     printf("\"hash\": %s, ", modelHash.c_str());
     printf("\"bptt\": %d, ", bptt);
+    printf("\"batch\": %d, ", batch);
     printf("\"ngram\": %d, ", ngram);
     printf("\"minFreq\": %d, ", minFreq);
     printf("\"lr\": %f, ", lr);
     printf("\"shrinkVal\": %f, ", shrinkVal);
     printf("\"epoch\": %d, ", e);
     printf("\"train_time\": %f, ", train_time);
+    printf("\"train_chars_per_sec\": %f, ",
+        train_time > 0.0 ? numTrainTokens / train_time : 0.0);
+    printf("\"load_mb_per_sec\": %f, ", dp_train.getLoadSpeed());
     printf("\"train_char_entropy\": %f, ", train_entropy);
     printf("\"train_logprob\": %f, ",
         train_entropy * numTrainTokens * log(2.0) / log(10.0));
@@ -205,6 +372,9 @@ int main(int argc, char** argv) {
     // checking for increase of validation entropy
     if (doShrink || 1.001 * valid_entropy - prev_valid_entropy > 0) {
       network.updateLearningRate(shrinkVal);
+      if (batchNetwork) {
+        batchNetwork->updateLearningRate(shrinkVal);
+      }
       printf("decreasing the learning rate to %f.\n", network.getLr());
       doShrink = true;
     }
@@ -10,6 +10,10 @@
 #include "Matrix.h"
 #include "Vector.h"
 #include <cblas.h>
+#include <string.h>
+#include <algorithm>
+#include <math.h>
+#include <float.h>
 
 using namespace std;
 
@@ -19,27 +23,54 @@ Matrix::Matrix() {
   m_ = 0;
   n_ = 0;
   data_ = NULL;
+  ownsData_ = true;
 }
 
 Matrix::Matrix(int m, int n) {
   m_ = m;
   n_ = n;
   data_ = new double[m*n];
+  ownsData_ = true;
 }
 
+// copying a view gives a matrix owning a copy of the viewed rows
 Matrix::Matrix(const Matrix& a) {
   m_ = a.m_;
   n_ = a.n_;
   data_ = new double[m_ * n_];
-  for (int i=0; i<m_; i++) {
-    for (int j=0; j<n_; j++) {
-      data_[i * n_ + j] = a.data_[i * n_ + j];
-    }
-  }
+  ownsData_ = true;
+  memcpy(data_, a.data_, (size_t) m_ * n_ * sizeof(double));
 }
 
 Matrix::~Matrix() {
+  if (ownsData_) {
+    delete[] data_;
+  }
+}
+
+// makes this matrix a view on the rows [i, i + m) of matrix a, the view is
+// invalidated when a is resized
+void Matrix::setView(Matrix& a, int i, int m) {
+  assert(i >= 0 && i + m <= a.m_);
+  if (ownsData_) {
+    delete[] data_;
+  }
+  m_ = m;
+  n_ = a.n_;
+  data_ = a.data_ + (size_t) i * a.n_;
+  ownsData_ = false;
+}
+
+// changes the number of rows, keeping the existing rows and zeroing the new
+void Matrix::resizeRows(int m) {
+  assert(ownsData_);
+  double* data = new double[(size_t) m * n_];
+  size_t nKept = (size_t) std::min(m, m_) * n_;
+  memcpy(data, data_, nKept * sizeof(double));
+  memset(data + nKept, 0, ((size_t) m * n_ - nKept) * sizeof(double));
   delete[] data_;
+  data_ = data;
+  m_ = m;
 }
 
 void Matrix::readMatrix(std::ifstream& file) {
@@ -137,11 +168,7 @@ void Matrix::scale(double a) {
 void Matrix::copy(Matrix& a) {
   assert(m_ == a.m_);
   assert(n_ == a.n_);
-  for (int i=0; i<m_; i++) {
-    for (int j=0; j<n_; j++) {
-      data_[i * n_ + j] = a.data_[i * n_ + j];
-    }
-  }
+  memcpy(data_, a.data_, (size_t) m_ * n_ * sizeof(double));
 }
 
 double Matrix::frobenius() {
@@ -252,3 +279,107 @@ void Matrix::vectorVectorT(double a, Vector& vecB, Vector& vecC) {
   }
 }
 
+
+// computes the GEMM this = a * op(A) * op(B) + d * this, op transposing the
+// matrix before it when its flag is true
+void Matrix::matrixMatrix(double a, Matrix& A, bool transA,
+                          Matrix& B, bool transB, double d) {
+  int k = transA ? A.m_ : A.n_;
+  assert(m_ == (transA ? A.n_ : A.m_));
+  assert(n_ == (transB ? B.m_ : B.n_));
+  assert(k == (transB ? B.n_ : B.m_));
+  if (USE_BLAS) {
+    cblas_dgemm(CblasRowMajor, transA ? CblasTrans : CblasNoTrans,
+        transB ? CblasTrans : CblasNoTrans, m_, n_, k, a, A.data_,
+        std::max(A.n_, 1), B.data_, std::max(B.n_, 1), d, data_,
+        std::max(n_, 1));
+    return;
+  }
+
+  // as in BLAS this is not read when d is 0, it may be uninitialized
+  if (d == 0.0) {
+    fillValue(0.0);
+  } else if (d != 1.0) {
+    scale(d);
+  }
+  for (int i=0; i<m_; i++) {
+    double* row = data_ + (size_t) i * n_;
+    if (transB && !transA) {
+      // rows of A and B are dotted
+      const double* r = A.data_ + (size_t) i * A.n_;
+      for (int j=0; j<n_; j++) {
+        const double* b = B.data_ + (size_t) j * B.n_;
+        double val = 0.0;
+        for (int l=0; l<k; l++) {
+          val += r[l] * b[l];
+        }
+        row[j] += a * val;
+      }
+    } else if (transB) {
+      for (int j=0; j<n_; j++) {
+        const double* b = B.data_ + (size_t) j * B.n_;
+        double val = 0.0;
+        for (int l=0; l<k; l++) {
+          val += A.data_[(size_t) l * A.n_ + i] * b[l];
+        }
+        row[j] += a * val;
+      }
+    } else {
+      // rows of B are accumulated
+      for (int l=0; l<k; l++) {
+        double x = a * (transA ? A.data_[(size_t) l * A.n_ + i] :
+            A.data_[(size_t) i * A.n_ + l]);
+        const double* b = B.data_ + (size_t) l * B.n_;
+        for (int j=0; j<n_; j++) {
+          row[j] += x * b[j];
+        }
+      }
+    }
+  }
+}
+
+void Matrix::sigmoid() {
+  for (int i=0; i<m_; i++) {
+    for (int j=0; j<n_; j++) {
+      data_[i * n_ + j] = 1.0 / (1 + exp(-data_[i * n_ + j]));
+    }
+  }
+}
+
+void Matrix::aTimesOneMinusA() {
+  for (int i=0; i<m_; i++) {
+    for (int j=0; j<n_; j++) {
+      data_[i * n_ + j] = data_[i * n_ + j] * (1.0 - data_[i * n_ + j]);
+    }
+  }
+}
+
+// in place update as this = this * b
+void Matrix::timesInPlace(Matrix& b) {
+  assert(m_ == b.m_);
+  assert(n_ == b.n_);
+  for (int i=0; i<m_; i++) {
+    for (int j=0; j<n_; j++) {
+      data_[i * n_ + j] *= b.data_[i * n_ + j];
+    }
+  }
+}
+
+// applies the softmax to each row
+void Matrix::softMaxRows() {
+  for (int i=0; i<m_; i++) {
+    double* row = data_ + (size_t) i * n_;
+    double M = -DBL_MAX;
+    for (int j=0; j<n_; j++) {
+      M = std::max(M, row[j]);
+    }
+    double sum = 0.0;
+    for (int j=0; j<n_; j++) {
+      row[j] = exp(row[j] - M);
+      sum += row[j];
+    }
+    for (int j=0; j<n_; j++) {
+      row[j] /= sum;
+    }
+  }
+}
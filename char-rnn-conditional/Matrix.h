@@ -24,6 +24,8 @@ class Matrix {
     Matrix(const Matrix&);
     ~Matrix();
     void readMatrix(std::ifstream&);
+    void setView(Matrix&, int, int);
+    void resizeRows(int);
     void fillRandom();
     void fillRandom(double);
     void fillRandn();
@@ -47,9 +49,19 @@ class Matrix {
 
     void addMatrices(Matrix&, Matrix&);
     void vectorVectorT(double, Vector&, Vector&);
+    void matrixMatrix(double, Matrix&, bool, Matrix&, bool, double);
+
+    // row-wise and element-wise operations
+    void sigmoid();
+    void aTimesOneMinusA();
+    void timesInPlace(Matrix&);
+    void softMaxRows();
+
     double* data_;
     int m_;
     int n_;
+    // false for views on the rows of another matrix
+    bool ownsData_;
 };
 
 #endif
@@ -11,17 +11,22 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <algorithm>
 
 Model::Model(int m,
             int d)
     : R_(m, m),
       A_(d, m),
+      U_(0, m),
       gR_(m, m),
       gA_(d, m),
+      gU_(0, m),
       dR_(m, m),
-      dA_(d, m) {
+      dA_(d, m),
+      dU_(0, m) {
   m_ = m;
   d_ = d;
+  nHistories_ = 0;
 }
 
 Model::Model(const Model& other)
@@ -33,9 +38,12 @@ Model::Model(const Model& other)
       gU_(other.gU_),
       dR_(other.dR_),
       dA_(other.dA_),
-      dU_(other.dU_) {
+      dU_(other.dU_),
+      historyIds_(other.historyIds_),
+      ngramHistory_(other.ngramHistory_) {
   m_ = other.m_;
   d_ = other.d_;
+  nHistories_ = other.nHistories_;
 }
 
 Model::~Model() {
@@ -47,38 +55,85 @@ void Model::copy(Model& other) {
   A_.copy(other.A_);
   gA_.copy(other.gA_);
 
-  // clearing the output layer and re-building with provided model
-  U_.clear();
-  gU_.clear();
-  dU_.clear();
-  for (auto it=other.U_.begin(); it!=other.U_.end(); ++it) {
-    Matrix paramTemp(it->second); // temporary copy of the other matrix
-    U_.insert({it->first, paramTemp});
-    Matrix gradTemp(other.gU_[it->first]);
-    gU_.insert({it->first, gradTemp});
-    Matrix deltaTemp(other.dU_[it->first]);
-    deltaTemp.fillValue(0.0);
-    dU_.insert({it->first, deltaTemp});
+  // the output layer is copied as whole slabs, the deltas are released
+  historyIds_ = other.historyIds_;
+  ngramHistory_ = other.ngramHistory_;
+  nHistories_ = other.nHistories_;
+  if (U_.m_ != other.U_.m_) {
+    U_.resizeRows(other.U_.m_);
+    gU_.resizeRows(other.U_.m_);
   }
+  U_.copy(other.U_);
+  gU_.copy(other.gU_);
+  dU_.resizeRows(0);
 }
 
-void Model::addHistory(std::wstring history) {
-  Matrix paramTemp(d_, m_);
-  paramTemp.fillRandn();
-  Matrix gradTemp(d_, m_);
-  gradTemp.fillValue(0.0);
-  Matrix deltaTemp(d_, m_);
-  deltaTemp.fillValue(0.0);
-  U_.insert({history, paramTemp});
-  gU_.insert({history, gradTemp});
-  dU_.insert({history, deltaTemp});
+// makes room in the slabs for n histories
+void Model::reserveHistories(int n) {
+  if (n * d_ > U_.m_) {
+    U_.resizeRows(n * d_);
+    gU_.resizeRows(n * d_);
+    if (dU_.m_ > 0) {
+      dU_.resizeRows(n * d_);
+    }
+  }
+}
+
+// appends a randomly initialized history to the slabs and returns its id
+int Model::addHistory(std::wstring history) {
+  if ((nHistories_ + 1) * d_ > U_.m_) {
+    reserveHistories(std::max(2 * nHistories_, 64));
+  }
+  int id = nHistories_;
+  nHistories_++;
+  historyIds_.insert({history, id});
+
+  Matrix param;
+  getHistory(id, param);
+  param.fillRandn();
+  return id;
+}
+
+// returns the id of a history, -1 if it is not in the model
+int Model::getHistoryId(std::wstring history) const {
+  auto it = historyIds_.find(history);
+  if (it == historyIds_.end()) {
+    return -1;
+  }
+  return it->second;
+}
+
+// returns the id of the longest suffix of history that is in the model, or
+// -1, without modifying the model so that it is safe for concurrent readers
+int Model::findHistory(std::wstring history) const {
+  while (true) {
+    int id = getHistoryId(history);
+    if (id >= 0 || history.empty()) {
+      return id;
+    }
+    history.erase(0, 1);
+  }
+}
+
+// sets param to a view on the output matrix of a history
+void Model::getHistory(int id, Matrix& param) {
+  assert(id >= 0 && id < nHistories_);
+  param.setView(U_, id * d_, d_);
+}
+
+// sets grad to a view on the output gradient of a history
+void Model::getHistoryGradient(int id, Matrix& grad) {
+  assert(id >= 0 && id < nHistories_);
+  grad.setView(gU_, id * d_, d_);
 }
 
 void Model::resetGradients() {
   gR_.fillValue(0.0);
   gA_.fillValue(0.0);
+  Matrix grad;
   for (auto it=ngramHistory_.begin(); it!=ngramHistory_.end(); ++it) {
-    gU_[*it].fillValue(0.0);
+    getHistoryGradient(*it, grad);
+    grad.fillValue(0.0);
   }
   ngramHistory_.clear();
 }
@@ -86,17 +141,19 @@ void Model::resetGradients() {
 void Model::resetDeltas() {
   dR_.fillValue(0.0);
   dA_.fillValue(0.0);
-  for (auto it=dU_.begin(); it!=dU_.end(); ++it) {
-    it->second.fillValue(0.0);
-  }
+  dU_.fillValue(0.0);
 }
 
 void Model::update(double gamma) {
   R_.addInPlace(-gamma, gR_);
   A_.addInPlace(-gamma, gA_);
 
+  Matrix param;
+  Matrix grad;
   for (auto it=ngramHistory_.begin(); it!=ngramHistory_.end(); ++it) {
-    U_[*it].addInPlace(-gamma, gU_[*it]);
+    getHistory(*it, param);
+    getHistoryGradient(*it, grad);
+    param.addInPlace(-gamma, grad);
   }
 }
 
@@ -112,19 +169,22 @@ void Model::initialize(char* type) {
 }
 
 void Model::pickDeltas() {
+  if (dU_.m_ != U_.m_) {
+    dU_.resizeRows(U_.m_);
+  }
   resetDeltas();
   dR_.fillRandn();
   dA_.fillRandn();
-  for (auto it=dU_.begin(); it!=dU_.end(); ++it) {
-    it->second.fillRandn();
-  }
+  Matrix delta;
+  delta.setView(dU_, 0, nHistories_ * d_);
+  delta.fillRandn();
 }
 
 void Model::addDeltas(double gamma) {
   R_.addInPlace(gamma, dR_);
   A_.addInPlace(gamma, dA_);
-  for (auto it=dU_.begin(); it!=dU_.end(); ++it) {
-    U_[it->first].addInPlace(gamma, dU_[it->first]);
+  if (dU_.m_ > 0) {
+    U_.addInPlace(gamma, dU_);
   }
 }
 
@@ -132,9 +192,12 @@ double Model::gradTDelta() {
   double result = 0.0;
   result += gR_.dotProduct(dR_);
   result += gA_.dotProduct(dA_);
+  Matrix grad;
+  Matrix delta;
   for (auto it=ngramHistory_.begin(); it!=ngramHistory_.end(); ++it) {
-    result += gU_[*it].dotProduct(dU_[*it]);
+    getHistoryGradient(*it, grad);
+    delta.setView(dU_, *it * d_, d_);
+    result += grad.dotProduct(delta);
   }
   return result;
 }
-
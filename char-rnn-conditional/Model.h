@@ -21,28 +21,39 @@ class Model {
     int m_;
     int d_;
 
-    // parameters
+    // parameters, the output matrices of the histories are stored in one
+    // slab as consecutive blocks of d_ rows indexed by history id
     Matrix R_;
     Matrix A_;
-    std::unordered_map<std::wstring, Matrix> U_;
+    Matrix U_;
 
     // gradients
     Matrix gR_;
     Matrix gA_;
-    std::unordered_map<std::wstring, Matrix> gU_;
+    Matrix gU_;
 
-    // perturbation
+    // perturbation, the history slab is only allocated by pickDeltas
     Matrix dR_;
     Matrix dA_;
-    std::unordered_map<std::wstring, Matrix> dU_;
+    Matrix dU_;
 
-    std::set<std::wstring> ngramHistory_;
+    // ids of the histories and number of them stored in the slabs
+    std::unordered_map<std::wstring, int> historyIds_;
+    int nHistories_;
+
+    // ids of the histories whose gradients are not zero
+    std::set<int> ngramHistory_;
 
     Model(int, int);
     Model(const Model&);
     ~Model();
     void copy(Model&);
-    void addHistory(std::wstring);
+    void reserveHistories(int);
+    int addHistory(std::wstring);
+    int getHistoryId(std::wstring) const;
+    int findHistory(std::wstring) const;
+    void getHistory(int, Matrix&);
+    void getHistoryGradient(int, Matrix&);
     void resetGradients();
     void resetDeltas();
     void update(double);
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "NgramCounter.h"
+#include <assert.h>
+#include <math.h>
+
+const uint64_t EMPTY_KEY = ~((uint64_t) 0);
+
+// mixing function of splitmix64
+static uint64_t hashKey(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static uint64_t makeKey(int node, int token) {
+  return ((uint64_t) node << 32) | (uint32_t) token;
+}
+
+NgramCounter::NgramCounter(int order) {
+  order_ = order;
+  width_ = 0;
+  nWindows_ = 0;
+  errorBound_ = 0;
+  parent_.push_back(-1);
+  token_.push_back(-1);
+  depth_.push_back(0);
+  count_.push_back(0);
+  delta_.push_back(0);
+  keys_.assign(1024, EMPTY_KEY);
+  values_.assign(1024, 0);
+  mask_ = 1023;
+}
+
+// lossy counting with buckets of ceil(1 / epsilon) windows
+NgramCounter::NgramCounter(int order, double epsilon)
+    : NgramCounter(order) {
+  if (epsilon > 0.0) {
+    width_ = (int) ceil(1.0 / epsilon);
+  }
+}
+
+NgramCounter::~NgramCounter() {
+}
+
+int NgramCounter::getNumNodes() {
+  return parent_.size();
+}
+
+// returns the slot holding key, or the empty slot where it should go
+int NgramCounter::findSlot(uint64_t key) {
+  uint64_t i = hashKey(key) & mask_;
+  while (keys_[i] != EMPTY_KEY && keys_[i] != key) {
+    i = (i + 1) & mask_;
+  }
+  return i;
+}
+
+// doubling the table once it is half full
+void NgramCounter::grow() {
+  std::vector<uint64_t> oldKeys;
+  std::vector<int> oldValues;
+  oldKeys.swap(keys_);
+  oldValues.swap(values_);
+  keys_.assign(2 * oldKeys.size(), EMPTY_KEY);
+  values_.assign(2 * oldKeys.size(), 0);
+  mask_ = keys_.size() - 1;
+  for (int i=0; i<oldKeys.size(); i++) {
+    if (oldKeys[i] != EMPTY_KEY) {
+      int slot = findSlot(oldKeys[i]);
+      keys_[slot] = oldKeys[i];
+      values_[slot] = oldValues[i];
+    }
+  }
+}
+
+// returns the node extending node with a preceding token, -1 if absent
+int NgramCounter::getChild(int node, int token) {
+  int slot = findSlot(makeKey(node, token));
+  if (keys_[slot] == EMPTY_KEY) {
+    return -1;
+  }
+  return values_[slot];
+}
+
+// returns the child of node for token, creating it if needed
+int NgramCounter::addChild(int node, int token) {
+  uint64_t key = makeKey(node, token);
+  int slot = findSlot(key);
+  if (keys_[slot] != EMPTY_KEY) {
+    return values_[slot];
+  }
+  int child = parent_.size();
+  parent_.push_back(node);
+  token_.push_back(token);
+  depth_.push_back(depth_[node] + 1);
+  count_.push_back(0);
+  delta_.push_back(errorBound_);
+  keys_[slot] = key;
+  values_[slot] = child;
+  if (2 * parent_.size() > keys_.size()) {
+    grow();
+  }
+  return child;
+}
+
+int NgramCounter::getCount(int node) {
+  return count_[node];
+}
+
+int NgramCounter::getDepth(int node) {
+  return depth_[node];
+}
+
+// maximal number of occurrences of an ngram missed before its node existed
+int NgramCounter::getDelta(int node) {
+  return delta_[node];
+}
+
+// maximal count of an ngram that is not in the tree
+int NgramCounter::getErrorBound() {
+  return errorBound_;
+}
+
+long long NgramCounter::getNumWindows() {
+  return nWindows_;
+}
+
+// counts the order_ suffixes of a window, the last token being the newest
+void NgramCounter::addWindow(const int* window) {
+  int node = 0;
+  for (int j=order_-1; j>=0; j--) {
+    node = addChild(node, window[j]);
+    count_[node]++;
+  }
+  nWindows_++;
+  if (width_ > 0 && nWindows_ % width_ == 0) {
+    prune(nWindows_ / width_);
+  }
+}
+
+// counts the windows ending at positions [begin, end) of a token array
+void NgramCounter::addWindows(const int* tokens, int begin, int end) {
+  for (int i=begin; i<end; i++) {
+    addWindow(tokens + i - order_ + 1);
+  }
+}
+
+// adds the counts of another tree, parents are always created before their
+// children so a single pass in node order maps the other nodes onto ours
+// the error bounds add up: an ngram missing from one of the trees has been
+// seen at most errorBound_ times in that part of the stream
+void NgramCounter::merge(NgramCounter& other) {
+  assert(order_ == other.order_);
+  int nOldNodes = getNumNodes();
+  std::vector<bool> matched(nOldNodes, false);
+  std::vector<int> nodeMap(other.getNumNodes(), 0);
+  for (int i=1; i<other.getNumNodes(); i++) {
+    nodeMap[i] = addChild(nodeMap[other.parent_[i]], other.token_[i]);
+    count_[nodeMap[i]] += other.count_[i];
+    delta_[nodeMap[i]] += other.delta_[i];
+    if (nodeMap[i] < nOldNodes) {
+      matched[nodeMap[i]] = true;
+    }
+  }
+  for (int i=1; i<nOldNodes; i++) {
+    if (!matched[i]) {
+      delta_[i] += other.errorBound_;
+    }
+  }
+  errorBound_ += other.errorBound_;
+  nWindows_ += other.nWindows_;
+  if (width_ > 0) {
+    prune(errorBound_);
+  }
+}
+
+// removes the ngrams (except unigrams) seen at most b times, together with
+// their extensions, which cannot have been seen more often
+void NgramCounter::prune(int b) {
+  std::vector<int> nodeMap(getNumNodes(), -1);
+  nodeMap[0] = 0;
+  int k = 1;
+  for (int i=1; i<getNumNodes(); i++) {
+    int parent = nodeMap[parent_[i]];
+    if (parent < 0 || (depth_[i] > 1 && count_[i] + delta_[i] <= b)) {
+      continue;
+    }
+    nodeMap[i] = k;
+    parent_[k] = parent;
+    token_[k] = token_[i];
+    depth_[k] = depth_[i];
+    count_[k] = count_[i];
+    delta_[k] = delta_[i];
+    k++;
+  }
+  parent_.resize(k);
+  token_.resize(k);
+  depth_.resize(k);
+  count_.resize(k);
+  delta_.resize(k);
+  errorBound_ = b;
+  rebuildTable();
+}
+
+// re-inserting the surviving nodes into a table sized for them
+void NgramCounter::rebuildTable() {
+  int size = 1024;
+  while (size < 2 * getNumNodes()) {
+    size *= 2;
+  }
+  keys_.assign(size, EMPTY_KEY);
+  values_.assign(size, 0);
+  mask_ = size - 1;
+  for (int i=1; i<getNumNodes(); i++) {
+    uint64_t key = makeKey(parent_[i], token_[i]);
+    int slot = findSlot(key);
+    keys_[slot] = key;
+    values_[slot] = i;
+  }
+}
+
+// retrieves the tokens of the ngram of a node, oldest token first
+void NgramCounter::getNgram(int node, std::vector<int>& tokens) {
+  assert(node >= 0 && node < parent_.size());
+  tokens.clear();
+  while (node != 0) {
+    tokens.push_back(token_[node]);
+    node = parent_[node];
+  }
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef NGRAMCOUNTER_H
+#define NGRAMCOUNTER_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+// Counts the suffixes of the ngram windows of a token stream.
+// Every suffix is a node of a context tree: the children of a node are the
+// tokens preceding it, so all the suffixes of a window are counted by a
+// single walk from the root, without building any string.
+//
+// With a positive epsilon the counts are approximated by lossy counting
+// (Manku and Motwani): every 1/epsilon windows the nodes whose count plus
+// maximal error is below the bucket number are pruned with their subtrees.
+// The memory stays bounded and a pruned ngram has been seen at most
+// epsilon * N times, so count <= true count <= count + delta <= count +
+// epsilon * N. Unigrams are never pruned.
+class NgramCounter {
+  private:
+    int order_;
+
+    // node storage, node 0 is the root (empty history)
+    std::vector<int> parent_;
+    std::vector<int> token_;
+    std::vector<int> depth_;
+    std::vector<int> count_;
+    std::vector<int> delta_;
+
+    // lossy counting state, width_ is 0 for exact counting
+    int width_;
+    long long nWindows_;
+    int errorBound_;
+
+    // open addressing table mapping (parent, token) to the child node
+    std::vector<uint64_t> keys_;
+    std::vector<int> values_;
+    uint64_t mask_;
+
+    void grow();
+    int findSlot(uint64_t);
+    void rebuildTable();
+
+  public:
+    NgramCounter(int);
+    NgramCounter(int, double);
+    ~NgramCounter();
+    int getNumNodes();
+    int getChild(int, int);
+    int addChild(int, int);
+    int getCount(int);
+    int getDepth(int);
+    int getDelta(int);
+    int getErrorBound();
+    long long getNumWindows();
+    void addWindow(const int*);
+    void addWindows(const int*, int, int);
+    void merge(NgramCounter&);
+    void prune(int);
+    void getNgram(int, std::vector<int>&);
+};
+
+#endif
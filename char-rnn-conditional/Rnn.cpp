@@ -136,12 +136,15 @@ double Rnn::computeEntropy() {
   return entropy;
 }
 
+// when not training the model is only read, so several networks sharing a
+// model can evaluate concurrently
 void Rnn::forward(int xt, int xtp1, std::wstring history, bool train,
                   double& entropy) {
-  if (step_ == 0) {
-    entropy += net_[0].forward(xt, xtp1, history, firstHidden_);
+  Vector& htm1 = (step_ == 0) ? firstHidden_ : net_[step_ - 1].ht_;
+  if (train) {
+    entropy += net_[step_].forward(xt, xtp1, history, htm1);
   } else {
-    entropy += net_[step_].forward(xt, xtp1, history, net_[step_ - 1].ht_);
+    entropy += net_[step_].evaluate(xt, xtp1, history, htm1);
   }
   step_++;
   if (step_ == T_) {
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stddef.h>
+
+// UTF-8 encoding and decoding independent of the locale. Invalid or
+// truncated sequences decode to U+FFFD, one per offending byte.
+const wchar_t REPLACEMENT_CHAR = 0xfffd;
+
+int encodeUtf8(wchar_t, char*);
+size_t decodeUtf8(const std::string&, wchar_t*, size_t);
+
+// Reads a UTF-8 file by blocks of bytes decoded to code points at once,
+// runs of ASCII bytes being widened 16 at a time when SSE2 is available.
+class Utf8Reader {
+  private:
+    FILE* f_;
+    std::vector<unsigned char> buf_;
+    size_t pending_;
+    size_t nBytes_;
+
+  public:
+    Utf8Reader(std::string);
+    ~Utf8Reader();
+    bool good();
+    size_t read(std::vector<wchar_t>&);
+    size_t getNumBytes();
+};
+
+#endif
@@ -188,7 +188,8 @@ void Vector::timesVectors(Vector& a, Vector& b) {
 }
 
 // computes the GEMV this = a * matB * vecC + d * this
-void Vector::matrixVector(double a, Matrix& matB, Vector& vecC, double d) {
+void Vector::matrixVector(double a, const Matrix& matB, Vector& vecC,
+                          double d) {
   assert(m_ == matB.m_);
   assert(matB.n_ == vecC.m_);
   if (USE_BLAS) {
@@ -199,19 +200,24 @@ void Vector::matrixVector(double a, Matrix& matB, Vector& vecC, double d) {
     int m = m_;
     int n = vecC.m_;
 
-    for (i=0; i < m/8; i++) {
-      data_[i * 8 + 0] *= d;
-      data_[i * 8 + 1] *= d;
-      data_[i * 8 + 2] *= d;
-      data_[i * 8 + 3] *= d;
-
-      data_[i * 8 + 4] *= d;
-      data_[i * 8 + 5] *= d;
-      data_[i * 8 + 6] *= d;
-      data_[i * 8 + 7] *= d;
-    }
-    for (int ip = i*8; ip<m; ip++) {
-      data_[ip] *= d;
+    // as in BLAS this is not read when d is 0, it may be uninitialized
+    if (d == 0.0) {
+      fillValue(0.0);
+    } else {
+      for (i=0; i < m/8; i++) {
+        data_[i * 8 + 0] *= d;
+        data_[i * 8 + 1] *= d;
+        data_[i * 8 + 2] *= d;
+        data_[i * 8 + 3] *= d;
+
+        data_[i * 8 + 4] *= d;
+        data_[i * 8 + 5] *= d;
+        data_[i * 8 + 6] *= d;
+        data_[i * 8 + 7] *= d;
+      }
+      for (int ip = i*8; ip<m; ip++) {
+        data_[ip] *= d;
+      }
     }
 
     double val0 = 0.0;
@@ -275,7 +281,7 @@ void Vector::matrixTVector(double a, Matrix& matB, Vector& vecC, double d) {
     int m = matB.m_;
     int n = matB.n_;
     for (int j=0; j<n; j++) {
-      data_[j] *= d;
+      data_[j] = (d == 0.0) ? 0.0 : d * data_[j];
     }
     for (int i=0; i<m; i++) {
       mult = vecC.data_[i];
@@ -47,7 +47,7 @@ class Vector {
     void addVectors(Vector&, Vector&);
     void timesVectors(Vector&, Vector&);
 
-    void matrixVector(double, Matrix&, Vector&, double);
+    void matrixVector(double, const Matrix&, Vector&, double);
     void matrixTVector(double, Matrix&, Vector&, double);
 
     int m_;
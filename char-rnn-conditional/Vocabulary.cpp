@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "Vocabulary.h"
+
+Vocabulary::Vocabulary() {
+}
+
+int Vocabulary::getNumChars() const {
+  return chars_.size();
+}
+
+// returns the id of a char, -1 if it is not in the vocabulary
+int Vocabulary::getId(wchar_t c) const {
+  return chars_.getId(c);
+}
+
+int Vocabulary::addChar(wchar_t c) {
+  return chars_.addChar(c);
+}
+
+wchar_t Vocabulary::getChar(int i) const {
+  return chars_.getChar(i);
+}
+
+int Vocabulary::getNumNgrams() const {
+  return validNgrams_.size();
+}
+
+bool Vocabulary::isValidNgram(const std::wstring& ngram) const {
+  return validNgrams_.count(ngram) > 0;
+}
+
+void Vocabulary::addNgram(const std::wstring& ngram) {
+  validNgrams_.insert(ngram);
+}
+
+// the char table followed by the valid ngrams
+void Vocabulary::write(CacheWriter& cache) const {
+  std::wstring chars;
+  for (int i=0; i<chars_.size(); i++) {
+    chars.push_back(chars_.getChar(i));
+  }
+  cache.writeWString(chars);
+  cache.writeInt(validNgrams_.size());
+  for (auto it=validNgrams_.begin(); it!=validNgrams_.end(); ++it) {
+    cache.writeWString(*it);
+  }
+}
+
+// reads a vocabulary written by write into an empty one
+bool Vocabulary::read(CacheReader& cache) {
+  std::wstring chars = cache.readWString();
+  int nNgrams = cache.readInt();
+  std::unordered_set<std::wstring> validNgrams;
+  for (int i=0; i<nNgrams && cache.good(); i++) {
+    validNgrams.insert(cache.readWString());
+  }
+  if (!cache.good()) {
+    return false;
+  }
+  for (int i=0; i<chars.size(); i++) {
+    chars_.addChar(chars[i]);
+  }
+  validNgrams_.swap(validNgrams);
+  return true;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef VOCABULARY_H
+#define VOCABULARY_H
+
+#include <unordered_set>
+#include <string>
+#include "CacheFile.h"
+#include "CharTable.h"
+
+// Chars and valid ngram histories of the training corpus. It is built by
+// the training data provider, then frozen and shared through a pointer to
+// const by the providers of the validation and test corpora.
+class Vocabulary {
+  private:
+    CharTable chars_;
+    std::unordered_set<std::wstring> validNgrams_;
+
+  public:
+    Vocabulary();
+    int getNumChars() const;
+    int getId(wchar_t) const;
+    int addChar(wchar_t);
+    wchar_t getChar(int) const;
+    int getNumNgrams() const;
+    bool isValidNgram(const std::wstring&) const;
+    void addNgram(const std::wstring&);
+    void write(CacheWriter&) const;
+    bool read(CacheReader&);
+};
+
+#endif
@@ -21,6 +21,7 @@ WordModule::WordModule(Model& modelRef)
 
   xt_ = 0;
   xtp1_ = 0;
+  historyId_ = -1;
   dTemp_.fillValue(0.0);
   mTemp_.fillValue(0.0);
 }
@@ -32,7 +33,6 @@ WordModule::~WordModule() {
 double WordModule::forward(int xt, int xtp1, std::wstring hist, Vector& htm1) {
   xt_ = xt;
   xtp1_ = xtp1;
-  history_ = hist;
   double entropy = 0;
 
   ht_.getRow(model_.A_, xt_);
@@ -41,11 +41,12 @@ double WordModule::forward(int xt, int xtp1, std::wstring hist, Vector& htm1) {
 
 
   // if the model does not contain the current history, init with random
-  if (model_.U_.count(history_) == 0) {
-    model_.addHistory(history_);
+  historyId_ = model_.getHistoryId(hist);
+  if (historyId_ < 0) {
+    historyId_ = model_.addHistory(hist);
   }
-  Matrix &temp = model_.U_.at(history_);
-  yt_.matrixVector(1.0, temp, ht_, 0.0);
+  model_.getHistory(historyId_, Ut_);
+  yt_.matrixVector(1.0, Ut_, ht_, 0.0);
   yt_.softMax();
 
   entropy -= log(yt_.get(xtp1)) / log(2.0);
@@ -53,20 +54,47 @@ double WordModule::forward(int xt, int xtp1, std::wstring hist, Vector& htm1) {
   return entropy;
 }
 
+// computes the output distribution with the longest suffix of the history
+// known to the model, the distribution is uniform if there is none
+void WordModule::computeOutput(std::wstring hist) {
+  historyId_ = model_.findHistory(hist);
+  if (historyId_ < 0) {
+    yt_.fillValue(1.0 / yt_.m_);
+  } else {
+    model_.getHistory(historyId_, Ut_);
+    yt_.matrixVector(1.0, Ut_, ht_, 0.0);
+    yt_.softMax();
+  }
+}
+
+// forward used for evaluation, it only reads the model: unknown histories
+// back off to their longest known suffix instead of being allocated
+double WordModule::evaluate(int xt, int xtp1, std::wstring hist,
+                            Vector& htm1) {
+  xt_ = xt;
+  xtp1_ = xtp1;
+
+  ht_.getRow(model_.A_, xt_);
+  ht_.matrixVector(1.0, model_.R_, htm1, 1.0);
+  ht_.sigmoid();
+
+  computeOutput(hist);
+
+  return -log(yt_.get(xtp1_)) / log(2.0);
+}
+
 // compute a forward without changing things
 double WordModule::computeProbability(int xt, int xtp1, std::wstring hist,
                                       Vector& htm1) {
   xt_ = xt;
   xtp1_ = xtp1;
-  history_ = hist;
 
 
   ht_.getRow(model_.A_, xt_);
   ht_.matrixVector(1.0, model_.R_, htm1, 1.0);
   ht_.sigmoid();
 
-  yt_.matrixVector(1.0, model_.U_[history_], ht_, 0.0);
-  yt_.softMax();
+  computeOutput(hist);
 
   return yt_.get(xtp1_);
 }
@@ -79,7 +107,8 @@ double WordModule::computeEntropy(Vector& htm1) {
   ht_.matrixVector(1.0, model_.R_, htm1, 1.0);
   ht_.sigmoid();
 
-  yt_.matrixVector(1.0, model_.U_[history_], ht_, 0.0);
+  model_.getHistory(historyId_, Ut_);
+  yt_.matrixVector(1.0, Ut_, ht_, 0.0);
   yt_.softMax();
 
   entropy -= log(yt_.get(xtp1_)) / log(2.0);
@@ -101,7 +130,8 @@ void WordModule::backward(Vector& htm1, Vector& htp1, Vector& lambdatp1) {
   dTemp_.addInPlace(-1.0, yt_);
   dTemp_.scale(1 / log(2.0));
 
-  lambda_.matrixTVector(1.0, model_.U_[history_], dTemp_, 0.0);
+  model_.getHistory(historyId_, Ut_);
+  lambda_.matrixTVector(1.0, Ut_, dTemp_, 0.0);
   lambda_.matrixTVector(1.0, model_.R_, mTemp_, 1.0);
 
   // computing derivatives of the output
@@ -110,8 +140,9 @@ void WordModule::backward(Vector& htm1, Vector& htp1, Vector& lambdatp1) {
   mTemp_.timesInPlace(lambda_);
 
   // computing the gradients
-  model_.ngramHistory_.insert(history_);
-  model_.gU_[history_].vectorVectorT(-1.0, dTemp_, ht_);
+  model_.ngramHistory_.insert(historyId_);
+  model_.getHistoryGradient(historyId_, gUt_);
+  gUt_.vectorVectorT(-1.0, dTemp_, ht_);
   model_.gR_.vectorVectorT(-1.0, mTemp_, htm1);
   model_.gA_.addRow(xt_, -1.0, mTemp_);
 }
@@ -121,11 +152,7 @@ int WordModule::generate(int ct, std::wstring hist, Vector& htm1) {
   ht_.matrixVector(1.0, model_.R_, htm1, 1.0);
   ht_.sigmoid();
 
-  if (model_.U_.count(hist) == 0) {
-    model_.addHistory(hist);
-  }
-  yt_.matrixVector(1.0, model_.U_[hist], ht_, 0.0);
-  yt_.softMax();
+  computeOutput(hist);
 
   return sampleFromVector(yt_);
 }
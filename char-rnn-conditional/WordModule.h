@@ -23,6 +23,12 @@ class WordModule {
     // reference to shared model
     Model& model_;
 
+    // views on the slabs of the model for the current history
+    Matrix Ut_;
+    Matrix gUt_;
+
+    void computeOutput(std::wstring);
+
     // temporary results in dimension d and m
     Vector dTemp_;
     Vector mTemp_;
@@ -31,7 +37,7 @@ class WordModule {
     // word level variables
     int xt_;
     int xtp1_;
-    std::wstring history_;
+    int historyId_;
     Vector ht_;
     Vector yt_;
     Vector lambda_;
@@ -39,6 +45,7 @@ class WordModule {
     WordModule(Model&);
     ~WordModule();
     double forward(int, int, std::wstring, Vector&);
+    double evaluate(int, int, std::wstring, Vector&);
     double computeEntropy(Vector&);
     double computeProbability(int, int, std::wstring, Vector&);
     void backward(Vector&, Vector&, Vector&);
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "BatchRnn.h"
+#include "WordModule.h"
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <chrono>
+
+BatchRnn::BatchRnn(Model& modelRef, int B, int T, double learningRate)
+    : model_(modelRef),
+      firstWordHidden_(B, modelRef.mw),
+      firstCharHidden_(B, modelRef.mc),
+      words_(T, std::vector<int>(B, 0)),
+      nextWords_(T, std::vector<int>(B, 0)),
+      chars_(T, std::vector<const int*>(B, NULL)),
+      lastChar_(T, std::vector<int>(B, 0)),
+      Ht_(T, Matrix(B, modelRef.mw)),
+      Yt_(T, Matrix(B, modelRef.dwV2)),
+      lastCharHidden_(T, Matrix(B, modelRef.mc)),
+      order_(T),
+      nActive_(T),
+      hp_(T),
+      yp_(T),
+      mup_(T),
+      wordDelta_(B, modelRef.mw),
+      charDelta_(B, modelRef.mc),
+      QHt_(B, modelRef.mc),
+      prevHidden_(B, modelRef.mc),
+      mcTemp_(B, modelRef.mc),
+      dcTemp_(B, modelRef.dc),
+      dwTemp_(B, modelRef.dwV2),
+      sums_(B, modelRef.mc),
+      sumsT_(B, modelRef.mc),
+      lambda_(B, modelRef.mw) {
+  B_ = B;
+  T_ = T;
+  lr_ = learningRate;
+  lr0_ = lr_;
+  reset();
+}
+
+void BatchRnn::reset() {
+  firstWordHidden_.fillValue(0.0);
+  firstCharHidden_.fillValue(0.0);
+  step_ = 0;
+}
+
+void BatchRnn::updateLearningRate(double shrinkVal) {
+  lr_ /= shrinkVal;
+  if (lr_ < 0.000001 * lr0_) {
+    lr_ = 0.000001 * lr0_;
+  }
+}
+
+double BatchRnn::getLr() {
+  return lr_;
+}
+
+// makes room for words of up to n chars at word step t
+void BatchRnn::reserveChars(int t, int n) {
+  while (hp_[t].size() < n) {
+    hp_[t].emplace_back(B_, model_.mc);
+    yp_[t].emplace_back(B_, model_.dc);
+    mup_[t].emplace_back(B_, model_.mc);
+  }
+}
+
+// forward of the words loaded at the current step, one per stream
+void BatchRnn::forward(double& wordEntropy, double& charEntropy,
+                       int& nChars) {
+  int t = step_;
+  int mw = model_.mw;
+  int mc = model_.mc;
+  Matrix& H = Ht_[t];
+  Matrix& Hprev = t == 0 ? firstWordHidden_ : Ht_[t - 1];
+  Matrix& Pprev = t == 0 ? firstCharHidden_ : lastCharHidden_[t - 1];
+  std::vector<int>& words = words_[t];
+  std::vector<const int*>& chars = chars_[t];
+  std::vector<int>& lastChar = lastChar_[t];
+
+  // computing the word hiddens
+  for (int b=0; b<B_; b++) {
+    std::copy(model_.Aw_.data_ + (size_t) words[b] * mw,
+        model_.Aw_.data_ + (size_t) (words[b] + 1) * mw, H.data_ + b * mw);
+  }
+  H.matrixMatrix(1.0, Hprev, false, model_.Rw_, true, 1.0);
+  H.sigmoid();
+
+  if (model_.alpha_ > 0.01) {
+    Matrix& Y = Yt_[t];
+    Y.matrixMatrix(1.0, H, false, model_.Uw_, true, 0.0);
+    Y.softMaxRows();
+    for (int b=0; b<B_; b++) {
+      wordEntropy -= log(Y.data_[(size_t) b * Y.n_ + nextWords_[t][b]]
+          + DBL_MIN) / log(2.0);
+    }
+  }
+
+  // the contribution of the word hidden is the same for all its chars
+  QHt_.matrixMatrix(1.0, H, false, model_.Q_, true, 0.0);
+
+  // sorting the streams by decreasing word length
+  std::vector<int>& order = order_[t];
+  order.resize(B_);
+  for (int b=0; b<B_; b++) {
+    order[b] = b;
+  }
+  std::stable_sort(order.begin(), order.end(), [&lastChar](int a, int b) {
+      return lastChar[a] > lastChar[b];
+  });
+  int maxLength = lastChar[order[0]];
+  reserveChars(t, maxLength);
+  std::vector<int>& nActive = nActive_[t];
+  nActive.assign(maxLength, 0);
+  for (int r=0; r<B_; r++) {
+    for (int i=0; i<lastChar[order[r]]; i++) {
+      nActive[i]++;
+    }
+    std::copy(Pprev.data_ + order[r] * mc, Pprev.data_ + (order[r] + 1) * mc,
+        prevHidden_.data_ + r * mc);
+  }
+
+  Matrix h;
+  Matrix prev;
+  Matrix y;
+  for (int i=0; i<maxLength; i++) {
+    int n = nActive[i];
+
+    // computing character hiddens
+    h.setView(hp_[t][i], 0, n);
+    for (int r=0; r<n; r++) {
+      const double* a = model_.Ac_.data_ + (size_t) chars[order[r]][i] * mc;
+      const double* q = QHt_.data_ + order[r] * mc;
+      for (int j=0; j<mc; j++) {
+        h.data_[r * mc + j] = a[j] + q[j];
+      }
+    }
+    prev.setView(i == 0 ? prevHidden_ : hp_[t][i - 1], 0, n);
+    h.matrixMatrix(1.0, prev, false, model_.Rc_, true, 1.0);
+    h.sigmoid();
+
+    // computing character outputs
+    y.setView(yp_[t][i], 0, n);
+    y.matrixMatrix(1.0, h, false, model_.Uc_, true, 0.0);
+    y.softMaxRows();
+    for (int r=0; r<n; r++) {
+      charEntropy -= log(y.data_[r * y.n_ + chars[order[r]][i + 1]]
+          + DBL_MIN) / log(2.0);
+    }
+  }
+
+  // keeping the last char hidden of each stream for the next step
+  for (int r=0; r<B_; r++) {
+    int b = order[r];
+    Matrix& last = hp_[t][lastChar[b] - 1];
+    std::copy(last.data_ + r * mc, last.data_ + (r + 1) * mc,
+        lastCharHidden_[t].data_ + b * mc);
+    nChars += lastChar[b];
+  }
+}
+
+// backward of word step t, wordDelta_ and charDelta_ hold the deltas of step
+// t + 1 and are replaced by the ones of step t
+void BatchRnn::backwardStep(int t) {
+  int mw = model_.mw;
+  int mc = model_.mc;
+  int dc = model_.dc;
+  Matrix& H = Ht_[t];
+  Matrix& Hprev = t == 0 ? firstWordHidden_ : Ht_[t - 1];
+  Matrix& Pprev = t == 0 ? firstCharHidden_ : lastCharHidden_[t - 1];
+  std::vector<int>& order = order_[t];
+  std::vector<int>& nActive = nActive_[t];
+  std::vector<const int*>& chars = chars_[t];
+  int maxLength = nActive.size();
+  double charScale = (1.0 - model_.alpha_) / log(2.0);
+
+  Matrix m;
+  Matrix d;
+  Matrix h;
+  Matrix mu;
+  sums_.fillValue(0.0);
+  for (int i=maxLength-1; i>=0; i--) {
+    int n = nActive[i];
+    int nNext = i + 1 < maxLength ? nActive[i + 1] : 0;
+
+    // delta of the next char hidden, the first char of the next word for
+    // the words ending at i
+    for (int r=0; r<n; r++) {
+      double* row = mcTemp_.data_ + r * mc;
+      if (r < nNext) {
+        const double* hn = hp_[t][i + 1].data_ + r * mc;
+        const double* mun = mup_[t][i + 1].data_ + r * mc;
+        for (int j=0; j<mc; j++) {
+          row[j] = hn[j] * (1.0 - hn[j]) * mun[j];
+        }
+      } else {
+        std::copy(charDelta_.data_ + order[r] * mc,
+            charDelta_.data_ + (order[r] + 1) * mc, row);
+      }
+    }
+
+    for (int r=0; r<n; r++) {
+      double* row = dcTemp_.data_ + r * dc;
+      const double* yr = yp_[t][i].data_ + r * dc;
+      for (int j=0; j<dc; j++) {
+        row[j] = -charScale * yr[j];
+      }
+      row[chars[order[r]][i + 1]] += charScale;
+    }
+
+    m.setView(mcTemp_, 0, n);
+    d.setView(dcTemp_, 0, n);
+    h.setView(hp_[t][i], 0, n);
+    mu.setView(mup_[t][i], 0, n);
+    mu.matrixMatrix(1.0, d, false, model_.Uc_, false, 0.0);
+    mu.matrixMatrix(1.0, m, false, model_.Rc_, false, 1.0);
+
+    // computing the gradients, the first chars of the next words are done
+    // by their step
+    model_.gUc_.matrixMatrix(-1.0, d, true, h, false, 1.0);
+    if (nNext > 0) {
+      m.setView(mcTemp_, 0, nNext);
+      h.setView(hp_[t][i], 0, nNext);
+      model_.gRc_.matrixMatrix(-1.0, m, true, h, false, 1.0);
+      for (int r=0; r<nNext; r++) {
+        double* g = model_.gAc_.data_ + (size_t) chars[order[r]][i + 1] * mc;
+        for (int j=0; j<mc; j++) {
+          sums_.data_[r * mc + j] += mcTemp_.data_[r * mc + j];
+          g[j] -= mcTemp_.data_[r * mc + j];
+        }
+      }
+    }
+  }
+
+  // delta of the first chars, back in stream order, with the sum of the
+  // char deltas going to the word hidden through Q
+  for (int r=0; r<B_; r++) {
+    int b = order[r];
+    const double* h0 = hp_[t][0].data_ + r * mc;
+    const double* mu0 = mup_[t][0].data_ + r * mc;
+    double* g = model_.gAc_.data_ + (size_t) chars[b][0] * mc;
+    for (int j=0; j<mc; j++) {
+      double delta = h0[j] * (1.0 - h0[j]) * mu0[j];
+      charDelta_.data_[b * mc + j] = delta;
+      sumsT_.data_[b * mc + j] = sums_.data_[r * mc + j] + delta;
+      g[j] -= delta;
+    }
+  }
+
+  // contribution of the next word hidden
+  lambda_.matrixMatrix(1.0, wordDelta_, false, model_.Rw_, false, 0.0);
+
+  if (model_.alpha_ > 0.01) {
+    // contribution of the prediction to hidden
+    double wordScale = model_.alpha_ / log(2.0);
+    int dw = model_.dwV2;
+    for (int b=0; b<B_; b++) {
+      double* row = dwTemp_.data_ + (size_t) b * dw;
+      const double* yr = Yt_[t].data_ + (size_t) b * dw;
+      for (int j=0; j<dw; j++) {
+        row[j] = -wordScale * yr[j];
+      }
+      row[nextWords_[t][b]] += wordScale;
+    }
+    lambda_.matrixMatrix(1.0, dwTemp_, false, model_.Uw_, false, 1.0);
+    model_.gUw_.matrixMatrix(-1.0, dwTemp_, true, H, false, 1.0);
+  }
+
+  // contribution of the chars to word hidden
+  lambda_.matrixMatrix(1.0, sumsT_, false, model_.Q_, false, 1.0);
+
+  wordDelta_.copy(H);
+  wordDelta_.aTimesOneMinusA();
+  wordDelta_.timesInPlace(lambda_);
+
+  // gradient of the word parameters
+  model_.gQ_.matrixMatrix(-1.0, sumsT_, true, H, false, 1.0);
+  model_.gRw_.matrixMatrix(-1.0, wordDelta_, true, Hprev, false, 1.0);
+  model_.gRc_.matrixMatrix(-1.0, charDelta_, true, Pprev, false, 1.0);
+
+  for (int b=0; b<B_; b++) {
+    int w = words_[t][b];
+    model_.updatedWordsList_.insert(w);
+    double* g = model_.gAw_.data_ + (size_t) w * mw;
+    for (int j=0; j<mw; j++) {
+      g[j] -= wordDelta_.data_[b * mw + j];
+    }
+  }
+}
+
+// the gradients of the streams are summed, the step is the one of a single
+// window
+void BatchRnn::backward() {
+  model_.resetGradients();
+  wordDelta_.fillValue(0.0);
+  charDelta_.fillValue(0.0);
+  for (int t=T_-1; t>=0; t--) {
+    backwardStep(t);
+  }
+  model_.update(lr_ / T_);
+}
+
+// one pass over the training tokens, the numTokens % B last ones being left
+void BatchRnn::train(DataProvider& dp,
+                     double& seconds,
+                     double& wordEntropy,
+                     double& charEntropy,
+                     int& nChars) {
+  wordEntropy = 0.0;
+  charEntropy = 0.0;
+  nChars = 0;
+  size_t nSteps = dp.getNumTokens() / B_;
+  std::vector<TokenCursor> cursors;
+  for (int b=0; b<B_; b++) {
+    cursors.push_back(dp.getCursor(b * nSteps, (b + 1) * nSteps));
+  }
+
+  int now = 0;
+  int next = 0;
+  const int* nextChars = NULL;
+  int nextLength = 0;
+  auto tic = std::chrono::steady_clock::now();
+  for (size_t s=0; s<nSteps; s++) {
+    for (int b=0; b<B_; b++) {
+      dp.getToken(cursors[b], now, next, nextChars, nextLength);
+      // as in WordModule2::loadData the chars are the ones of the next word
+      assert(nextLength + 1 < MAX_WORD_LENGTH);
+      words_[step_][b] = now;
+      nextWords_[step_][b] = next;
+      chars_[step_][b] = nextChars;
+      lastChar_[step_][b] = nextLength + 1;
+    }
+    forward(wordEntropy, charEntropy, nChars);
+    step_++;
+    if (step_ == T_) {
+      backward();
+      // copying the usefull hiddens
+      firstWordHidden_.copy(Ht_[T_ - 1]);
+      firstCharHidden_.copy(lastCharHidden_[T_ - 1]);
+      step_ = 0;
+    }
+  }
+  auto toc = std::chrono::steady_clock::now();
+  seconds = std::chrono::duration_cast<std::chrono::milliseconds>
+      (toc - tic).count() / 1000.0;
+}
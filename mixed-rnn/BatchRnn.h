@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef BATCHRNN_H
+#define BATCHRNN_H
+
+#include "Model.h"
+#include "Matrix.h"
+#include "DataProvider.h"
+#include <vector>
+
+// Trains a model on B streams at once, stream b reading the b-th of B
+// contiguous shards of the training tokens. The streams go through the
+// BPTT windows in lockstep and their hiddens are the rows of matrices, so
+// that the products with the parameters are matrix-matrix products. The
+// gradients of the B windows are summed and applied once per window.
+//
+// At the char level the rows of a word step are sorted by decreasing word
+// length, the streams whose word has more than i chars being the first rows
+// of char position i, and the shorter words are masked out by only using
+// these rows.
+class BatchRnn {
+  private:
+    Model& model_;
+    int B_;
+    int T_;
+    int step_;
+    double lr_;
+    double lr0_;
+
+    // hiddens carried from the previous window, one row per stream
+    Matrix firstWordHidden_;
+    Matrix firstCharHidden_;
+
+    // input of every word step, in stream order
+    std::vector<std::vector<int>> words_;
+    std::vector<std::vector<int>> nextWords_;
+    std::vector<std::vector<const int*>> chars_;
+    std::vector<std::vector<int>> lastChar_;
+
+    // word level activations, in stream order
+    std::vector<Matrix> Ht_;
+    std::vector<Matrix> Yt_;
+    std::vector<Matrix> lastCharHidden_;
+
+    // char level activations, in sorted order: order_[t][r] is the stream
+    // of row r and nActive_[t][i] the number of rows at char position i
+    std::vector<std::vector<int>> order_;
+    std::vector<std::vector<int>> nActive_;
+    std::vector<std::vector<Matrix>> hp_;
+    std::vector<std::vector<Matrix>> yp_;
+    std::vector<std::vector<Matrix>> mup_;
+
+    // deltas of the word hidden and of its first char hidden, in stream
+    // order, passed to the word step before
+    Matrix wordDelta_;
+    Matrix charDelta_;
+
+    // temporaries
+    Matrix QHt_;
+    Matrix prevHidden_;
+    Matrix mcTemp_;
+    Matrix dcTemp_;
+    Matrix dwTemp_;
+    Matrix sums_;
+    Matrix sumsT_;
+    Matrix lambda_;
+
+    void forward(double&, double&, int&);
+    void backward();
+    void backwardStep(int);
+    void reserveChars(int, int);
+
+  public:
+    BatchRnn(Model&, int, int, double);
+    void reset();
+    void updateLearningRate(double);
+    double getLr();
+    void train(DataProvider&, double&, double&, double&, int&);
+};
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "CharTable.h"
+#include <assert.h>
+#include <stdint.h>
+
+const uint32_t BMP_SIZE = 0x10000;
+
+CharTable::CharTable()
+    : bmp_(BMP_SIZE, -1),
+      astralKeys_(16, 0),
+      astralIds_(16, -1) {
+  nAstral_ = 0;
+}
+
+int CharTable::size() const {
+  return chars_.size();
+}
+
+// returns the slot of an astral char, or the empty slot where it should go
+int CharTable::findAstral(wchar_t c) const {
+  uint32_t mask = astralIds_.size() - 1;
+  uint32_t i = (((uint32_t) c * 0x9e3779b1u) >> 8) & mask;
+  while (astralIds_[i] >= 0 && astralKeys_[i] != c) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+// keeping the astral table at most a quarter full
+void CharTable::growAstral() {
+  std::vector<wchar_t> oldKeys;
+  std::vector<int> oldIds;
+  oldKeys.swap(astralKeys_);
+  oldIds.swap(astralIds_);
+  astralKeys_.assign(2 * oldKeys.size(), 0);
+  astralIds_.assign(2 * oldKeys.size(), -1);
+  for (int i=0; i<oldKeys.size(); i++) {
+    if (oldIds[i] >= 0) {
+      int slot = findAstral(oldKeys[i]);
+      astralKeys_[slot] = oldKeys[i];
+      astralIds_[slot] = oldIds[i];
+    }
+  }
+}
+
+// returns the id of a char, -1 if it is not in the table
+int CharTable::getId(wchar_t c) const {
+  if ((uint32_t) c < BMP_SIZE) {
+    return bmp_[c];
+  }
+  return astralIds_[findAstral(c)];
+}
+
+// returns the id of a char, adding it to the table if needed
+int CharTable::addChar(wchar_t c) {
+  int id = getId(c);
+  if (id >= 0) {
+    return id;
+  }
+  id = chars_.size();
+  chars_.push_back(c);
+  if ((uint32_t) c < BMP_SIZE) {
+    bmp_[c] = id;
+    return id;
+  }
+  int slot = findAstral(c);
+  astralKeys_[slot] = c;
+  astralIds_[slot] = id;
+  nAstral_++;
+  if (4 * nAstral_ > astralIds_.size()) {
+    growAstral();
+  }
+  return id;
+}
+
+wchar_t CharTable::getChar(int id) const {
+  assert(id >= 0 && id < chars_.size());
+  return chars_[id];
+}
@@ -8,43 +8,114 @@
  */
 
 #include "DataProvider.h"
+#include "Utf8.h"
 #include <iostream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <array>
 #include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 DataProvider::DataProvider() {
-  word2int_.insert({"<unk>", 0});
-  int2word_.insert({0, "<unk>"});
-  lastIdx_ = 1;
-  currIdx_ = tokens_.begin();
+  oovSpanStart_.push_back(0);
+  nThreads_ = 1;
+  currIdx_ = 0;
+  cacheKey_ = 0;
+  streamChunk_ = 0;
+  packing_ = false;
+  loadBytes_ = 0;
+  loadSeconds_ = 0.0;
 }
 
 DataProvider::~DataProvider() {
 }
 
-int DataProvider::addWord(std::string s, bool isTrain) {
-  int count = word2int_.count(s);
-  if (count == 0) {
-    word2int_.insert({s, lastIdx_});
-    int2word_.insert({lastIdx_, s});
-    tokens_.push_back(lastIdx_);
-    wordCount_.insert({lastIdx_, 1});
-    if (!isTrain) {
-      outOfVocabulary_.insert(lastIdx_);
-      restrictedVocab1_.insert({lastIdx_, 0});
-      restrictedVocab2_.insert({lastIdx_, 0});
+// adds a word of a validation or test corpus, the words missing from the
+// vocabulary are given ids after it and are out of V1 and V2
+int DataProvider::addWord(const std::string& s) {
+  int idx = vocab_->find(s);
+  if (idx < 0) {
+    int nOov = oovWords_.size();
+    idx = oovWords_.add(s);
+    if (idx == nOov) {
+      vocab_->appendSpan(s, oovCharIds_);
+      oovSpanStart_.push_back(oovCharIds_.size());
     }
-    lastIdx_++;
-    return lastIdx_-1;
-  } else {
-    int idx = word2int_[s];
-    wordCount_[idx] ++;
-    tokens_.push_back(idx);
-    return idx;
+    idx += vocab_->size();
+  }
+  tokens_.push_back(idx);
+  return idx;
+}
+
+// number of threads used to decode the training files and count their
+// words
+void DataProvider::setNumThreads(int nThreads) {
+  nThreads_ = std::max(nThreads, 1);
+}
+
+// directory where the preprocessed corpora are cached, none if empty
+void DataProvider::setCacheDir(std::string cacheDir) {
+  cacheDir_ = cacheDir;
+}
+
+// streams the tokens by chunks of chunkSize tokens instead of keeping them
+// in memory, 0 to disable
+void DataProvider::setStreaming(size_t chunkSize) {
+  streamChunk_ = chunkSize;
+  tokens_.setChunkSize(chunkSize);
+}
+
+// bit-packs the tokens kept in memory to as many bits as the largest id
+// needs, as they are read
+void DataProvider::setPacking(bool packing) {
+  packing_ = packing;
+}
+
+// spools the tokens of a streamed corpus next to it, the others are kept in
+// memory, packed as they are read when packing is set
+bool DataProvider::startSpool(std::string fname) {
+  if (streamChunk_ > 0) {
+    if (tokens_.openSpool(fname + ".tok")) {
+      return true;
+    }
+    fprintf(stderr, "Could not create %s.tok, reading %s in memory\n",
+        fname.c_str(), fname.c_str());
+    tokens_.setChunkSize(0);
+  }
+  if (packing_) {
+    tokens_.pack();
+  }
+  return false;
+}
+
+void DataProvider::endSpool(std::string fname) {
+  if (!tokens_.closeSpool()) {
+    fprintf(stderr, "Could not write %s.tok\n", fname.c_str());
+    exit(1);
   }
 }
 
+// accounts for the bytes decoded since tic
+void DataProvider::addLoadTime(size_t nBytes,
+    std::chrono::steady_clock::time_point tic) {
+  auto toc = std::chrono::steady_clock::now();
+  loadBytes_ += nBytes;
+  loadSeconds_ += std::chrono::duration_cast<std::chrono::microseconds>
+      (toc - tic).count() / 1e6;
+}
+
+// speed of the decoding of the corpus files, in MB per second
+double DataProvider::getLoadSpeed() {
+  if (loadSeconds_ <= 0.0) {
+    return 0.0;
+  }
+  return loadBytes_ / (1024.0 * 1024.0) / loadSeconds_;
+}
+
 int DataProvider::getNumTokens() {
   return tokens_.size();
 }
@@ -53,21 +124,22 @@ int DataProvider::getNumTokens() {
 void DataProvider::getNumWords(int& numWordsV0,
                                 int& numWordsV1,
                                 int& numWordsV2) {
-  numWordsV0 = word2int_.size();
-  numWordsV1 = V1_;
-  numWordsV2 = V2_;
+  numWordsV0 = vocab_->size();
+  numWordsV1 = vocab_->getV1();
+  numWordsV2 = vocab_->getV2();
 }
 
 // return size of char vocabulary
 int DataProvider::getNumChars() {
-  return char2int_.size();
+  return vocab_->getCharTable().size();
 }
 
 // counting how many tokens are OOV
 int DataProvider::countOutOfVocab() {
   int nOOV = 0;
-  for (auto it=tokens_.begin(); it!=tokens_.end(); ++it) {
-    if (outOfVocabulary_.find(*it)!=outOfVocabulary_.end()) {
+  int nWords = vocab_->size();
+  for (size_t i=0; i<tokens_.size(); i++) {
+    if (tokens_.get(i) >= nWords) {
       nOOV ++;
     }
   }
@@ -77,192 +149,560 @@ int DataProvider::countOutOfVocab() {
 // return the word id in the input vocabulary V1
 // if not present, provide the id of <unk>
 int DataProvider::getWordId(std::string str) {
-  if (word2int_.count(str) == 0) {
-    return 0;
-  } else {
-    int idx = word2int_[str];
-    return restrictedVocab1_[idx];
-  }
+  return vocab_->getWordId(str);
 }
 
 void DataProvider::printDictionary() {
-  int k = 0;
-  for (auto it = int2word_.begin(); it != int2word_.end(); ++it) {
-    if (restrictedVocab2_[it->first] > 0) {
-      printf("%-50s\t\t%8d ", it->second.c_str(),  wordCount_[it->first]);
-      printf("V0:%8d ", it->first);
-      printf("V1:%8d ", restrictedVocab1_[it->first]);
-      printf("V2:%8d ", restrictedVocab2_[it->first]);
+  for (int i=0; i<vocab_->size(); i++) {
+    if (vocab_->getRestrictedId2(i) > 0) {
+      printf("%-50s\t\t%8d ", vocab_->getWord(i).c_str(),
+          vocab_->getCount(i));
+      printf("V0:%8d ", i);
+      printf("V1:%8d ", vocab_->getRestrictedId1(i));
+      printf("V2:%8d ", vocab_->getRestrictedId2(i));
       printf("\n");
     }
   }
 }
 
 void DataProvider::printTokens() {
-  for (auto it = tokens_.begin(); it != tokens_.end(); ++it) {
-    std::cout << *it << std::endl;
+  for (size_t i=0; i<tokens_.size(); i++) {
+    std::cout << tokens_.get(i) << std::endl;
   }
 }
 
 void DataProvider::initIterator() {
-  currIdx_ = tokens_.begin();
+  currIdx_ = 0;
 }
 
-void DataProvider::getToken(int& now, int& next, std::string& nextWord) {
-  now = *currIdx_;
+// the chars of the next word are given as a span of char ids, see
+// buildCharSpans
+void DataProvider::getToken(int& now, int& next,
+                            const int*& nextChars, int& nextLength) {
+  now = tokens_.get(currIdx_);
   currIdx_++;
-  if (currIdx_ == tokens_.end()) {
-    currIdx_ = tokens_.begin();
+  if (currIdx_ == tokens_.size()) {
+    currIdx_ = 0;
+  }
+  next = tokens_.get(currIdx_);
+  mapToken(now, next, nextChars, nextLength);
+}
+
+// a cursor over the tokens [begin, end), several of them can be read from
+// different threads
+TokenCursor DataProvider::getCursor(size_t begin, size_t end) {
+  return TokenCursor(tokens_, begin, end);
+}
+
+// copies the tokens [begin, end) and the one following them (the first one
+// after the last) to an array, allocated by the calling thread and packed
+// like the tokens
+void DataProvider::copyTokens(size_t begin, size_t end, TokenArray& out) {
+  out.clear();
+  if (tokens_.getBits() > 0) {
+    out.pack();
+  } else {
+    out.reserve(end - begin + 1);
+  }
+  TokenCursor cursor(tokens_, begin, end);
+  int now = 0;
+  int next = 0;
+  for (size_t i=begin; i<end; i++) {
+    cursor.next(now, next);
+    out.push_back(now);
+  }
+  out.push_back(next);
+}
+
+void DataProvider::getToken(TokenCursor& cursor, int& now, int& next,
+                            const int*& nextChars, int& nextLength) {
+  cursor.next(now, next);
+  mapToken(now, next, nextChars, nextLength);
+}
+
+// gives the span of the next word and the restricted ids of both
+void DataProvider::mapToken(int& now, int& next,
+                            const int*& nextChars, int& nextLength) {
+  int nWords = vocab_->size();
+  if (next < nWords) {
+    vocab_->getSpan(next, nextChars, nextLength);
+  } else {
+    size_t* start = oovSpanStart_.data() + next - nWords;
+    nextChars = oovCharIds_.data() + start[0];
+    nextLength = start[1] - start[0] - 3;
   }
-  next = *currIdx_;
-  nextWord = getWord(next);
 
   // remapping to the restricted vocabs
-  now = restrictedVocab1_[now];
-  next = restrictedVocab2_[next];
+  now = vocab_->getRestrictedId1(now);
+  next = vocab_->getRestrictedId2(next);
 }
 
 std::string DataProvider::getWord(int i) {
-  return int2word_[i];
+  int nWords = vocab_->size();
+  return i < nWords ? vocab_->getWord(i) : oovWords_.get(i - nWords);
 }
 
 void DataProvider::printCharTable() {
   char mbs[16];
   int nBytes;
-  for (auto it = char2int_.begin(); it != char2int_.end(); ++it) {
-    nBytes = wctomb(mbs, it->first);
-    printf("%lc : %x : %d : ", it->first, it->first, it->second);
-    for (int i=0; i<nBytes; i++) {
-      printf("%x ", 0xff & mbs[i]);
+  const CharTable& table = vocab_->getCharTable();
+  for (int i=0; i<table.size(); i++) {
+    wchar_t c = table.getChar(i);
+    nBytes = encodeUtf8(c, mbs);
+    printf("%lc : %x : %d : ", c, c, i);
+    for (int j=0; j<nBytes; j++) {
+      printf("%x ", 0xff & mbs[j]);
     }
     printf("\n");
   }
 }
 
-void DataProvider::computeRestrictedVocabs(int V1, int V2) {
-
-  // sorting the word occurences
+// words counted by one thread over a shard of the training text, with their
+// local ids given in order of first occurrence
+struct WordShard {
+  WordTable words;
   std::vector<int> counts;
-  for (auto it=wordCount_.begin(); it!=wordCount_.end(); ++it) {
-    counts.push_back(it->second);
+  std::vector<int> tokens;
+};
+
+static void countWords(const std::string* text, size_t begin, size_t end,
+                       WordShard* shard) {
+  size_t start = begin;
+  for (size_t i=begin; i<end; i++) {
+    if ((*text)[i] != '_') {
+      continue;
+    }
+    int idx = shard->words.add(text->data() + start, i - start);
+    if (idx < shard->counts.size()) {
+      shard->counts[idx]++;
+    } else {
+      shard->counts.push_back(1);
+    }
+    shard->tokens.push_back(idx);
+    start = i + 1;
+  }
+}
+
+// name of the cache of a corpus, unique for its content and options
+std::string DataProvider::getCachePath(std::string fname) {
+  size_t slash = fname.find_last_of('/');
+  std::string base = (slash == std::string::npos) ?
+      fname : fname.substr(slash + 1);
+  char key[32];
+  snprintf(key, sizeof(key), "%016llx", (unsigned long long) cacheKey_);
+  return cacheDir_ + "/" + base + "." + key + ".cache";
+}
+
+// the training cache holds the vocabulary and the file offsets, the
+// validation and test caches only the words missing from it
+bool DataProvider::saveCache(std::string path, bool isTrain) {
+  CacheWriter cache(path, cacheKey_);
+  if (isTrain) {
+    vocab_->write(cache);
+    cache.writeInt(fileOffsets_.size());
+    for (int i=0; i<fileOffsets_.size(); i++) {
+      cache.writeInt(fileOffsets_[i]);
+    }
+  } else {
+    cache.writeInt(oovWords_.size());
+    for (int i=0; i<oovWords_.size(); i++) {
+      cache.writeString(oovWords_.get(i));
+    }
+  }
+  cache.writeTokens(tokens_);
+  return cache.close();
+}
+
+// the state is only updated once the whole cache has been read, the
+// vocabulary of the training corpus must be set for the other corpora
+bool DataProvider::loadCache(std::string path, bool isTrain) {
+  CacheReader cache(path, cacheKey_);
+  std::shared_ptr<Vocabulary> vocab = std::make_shared<Vocabulary>();
+  std::vector<std::string> words;
+  std::vector<size_t> offsets;
+  if (isTrain) {
+    if (!vocab->read(cache)) {
+      return false;
+    }
+    int nFiles = cache.readInt();
+    for (int i=0; i<nFiles && cache.good(); i++) {
+      offsets.push_back(cache.readInt());
+    }
+  } else {
+    int nWords = cache.readInt();
+    for (int i=0; i<nWords && cache.good(); i++) {
+      words.push_back(cache.readString());
+    }
+  }
+  cache.readTokens(tokens_);
+  if (!cache.good() ||
+      (isTrain && (offsets.empty() || offsets.back() != tokens_.size()
+      || !std::is_sorted(offsets.begin(), offsets.end())))) {
+    tokens_.clear();
+    return false;
+  }
+  // the tokens of the cache are mapped, they are packed from its pages
+  if (packing_) {
+    tokens_.pack();
+  }
+
+  if (isTrain) {
+    vocab_ = vocab;
+    fileOffsets_.swap(offsets);
+  }
+  for (int i=0; i<words.size(); i++) {
+    oovWords_.add(words[i]);
+    vocab_->appendSpan(words[i], oovCharIds_);
+    oovSpanStart_.push_back(oovCharIds_.size());
+  }
+  std::cout << " loaded cache " << path;
+  return true;
+}
+
+// adds the words of the training text, counted by nThreads_ threads
+void DataProvider::addTrainText(std::string& text, Vocabulary& vocab) {
+  // splitting the text on underscores into one shard per thread, '_' never
+  // appears inside a multibyte character so the words are left intact
+  std::vector<size_t> bounds(1, 0);
+  for (int s=1; s<nThreads_; s++) {
+    size_t pos = std::max(text.size() * s / nThreads_, bounds.back());
+    pos = text.find('_', pos);
+    if (pos == std::string::npos) {
+      break;
+    }
+    bounds.push_back(pos + 1);
+  }
+  bounds.push_back(text.size());
+
+  int nShards = bounds.size() - 1;
+  std::vector<WordShard> shards(nShards);
+  std::vector<std::thread> workers;
+  for (int s=0; s<nShards; s++) {
+    workers.push_back(std::thread(countWords, &text, bounds[s], bounds[s+1],
+          &shards[s]));
   }
-  std::sort(counts.begin(), counts.end(), [](int a, int b) {
-      return b < a;
+  for (int s=0; s<nShards; s++) {
+    workers[s].join();
+  }
+
+  // merging in shard order gives the ids that addWord assigns serially
+  for (int s=0; s<nShards; s++) {
+    WordShard& shard = shards[s];
+    std::vector<int> localToGlobal(shard.words.size());
+    for (int i=0; i<shard.words.size(); i++) {
+      localToGlobal[i] = vocab.addWord(shard.words.get(i), shard.counts[i]);
+    }
+    for (int i=0; i<shard.tokens.size(); i++) {
+      tokens_.push_back(localToGlobal[shard.tokens[i]]);
+    }
+  }
+}
+
+// a training file decoded by a worker thread, newChars holds its chars in
+// the order of their first occurrence in the file
+struct FileShard {
+  std::vector<wchar_t> newChars;
+  WordShard words;
+  size_t nBytes;
+};
+
+// the files decoded by the workers and merged in file order by the caller,
+// a file being decoded at most window files ahead of the merged ones so
+// that only a few shards are held at once
+struct FileQueue {
+  const std::vector<std::string>* fnames;
+  std::vector<FileShard> shards;
+  std::vector<bool> ready;
+  int next;
+  int merged;
+  int window;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+// the next file to decode, -1 when none is left
+static int nextFile(FileQueue* queue) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  queue->cv.wait(lock, [queue] {
+      return queue->next >= queue->fnames->size()
+          || queue->next < queue->merged + queue->window;
   });
+  if (queue->next >= queue->fnames->size()) {
+    return -1;
+  }
+  return queue->next++;
+}
 
-  int k1 = 0;
-  int k2 = 0;
-  for (auto it=wordCount_.begin(); it!=wordCount_.end(); ++it) {
-    if (it->second <= V1) {
-      restrictedVocab1_.insert({it->first, 0});
-      restrictedVocab2_.insert({it->first, 0});
-    } else if (it->second < counts[V2]) {
-      k1++;
-      restrictedVocab1_.insert({it->first, k1});
-      restrictedVocab2_.insert({it->first, 0});
-    } else {
-      k1++;
-      k2++;
-      restrictedVocab1_.insert({it->first, k1});
-      restrictedVocab2_.insert({it->first, k2});
+// waits for file i to be decoded
+static FileShard& waitFile(FileQueue* queue, int i) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  queue->cv.wait(lock, [queue, i] { return queue->ready[i]; });
+  return queue->shards[i];
+}
+
+// frees the shard of file i once merged, letting the workers go on
+static void releaseFile(FileQueue* queue, int i) {
+  queue->shards[i] = FileShard();
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  queue->merged = i + 1;
+  queue->cv.notify_all();
+}
+
+// decodes the files of the queue taken in turn until none is left and
+// counts their words, a word left unfinished at the end of a file is
+// dropped
+static void decodeShards(FileQueue* queue) {
+  CharTable seen;
+  std::vector<int> lastFile;
+  std::vector<wchar_t> chars;
+  char mbs[16];
+  std::string text;
+  int i;
+  while ((i = nextFile(queue)) >= 0) {
+    FileShard& shard = queue->shards[i];
+    Utf8Reader reader((*queue->fnames)[i]);
+    text.clear();
+    while (reader.read(chars) > 0) {
+      for (size_t j=0; j<chars.size(); j++) {
+        wchar_t c = chars[j];
+        if (c == '_') {
+          text.push_back('_');
+          continue;
+        }
+        int id = seen.addChar(c);
+        if (id == lastFile.size()) {
+          lastFile.push_back(-1);
+        }
+        if (lastFile[id] != i) {
+          lastFile[id] = i;
+          shard.newChars.push_back(c);
+        }
+        int nBytes = encodeUtf8(c, mbs);
+        text.append(mbs, nBytes);
+      }
     }
-    // std::cout << int2word_[it->first] << " " << it->second;
-    // std::cout << " V1=" << restrictedVocab1_[it->first];
-    // std::cout << " V2=" << restrictedVocab2_[it->first] << std::endl;
+    countWords(&text, 0, text.size(), &shard.words);
+    shard.nBytes = reader.getNumBytes();
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->ready[i] = true;
+    queue->cv.notify_all();
   }
-  V1_ = k1;
-  V2_ = k2;
 }
 
-void DataProvider::readFromFile(std::string fname, int V1, int V2) {
-  std::cout << "Loading data from file: " << fname;
-  std::locale::global(std::locale(""));
-  std::wifstream ifs(fname);
-  wchar_t c;
+// decodes the files one after the other, the words of a streamed corpus
+// are spooled as they are read, the others counted in parallel file by file,
+// returns the number of bytes read
+size_t DataProvider::readFiles(const std::vector<std::string>& fnames,
+                               Vocabulary& vocab, bool streaming) {
+  size_t nBytesRead = 0;
+  std::vector<wchar_t> chars;
   char mbs[16];
   int nBytes;
-  int maxWordLength = 0;
-
-  char2int_.insert({'_', 0});
-  int2char_.insert({0, '_'});
-  int k = 1;
+  std::string text;
   std::string str;
-  while (ifs.get(c)) {
-    if (c == '_') {
-      addWord(str, true);
-      if (str.length() > maxWordLength) {
-        maxWordLength = str.length();
-      }
-      str.clear();
-    } else {
-      if (char2int_.count(c)==0) {
-        char2int_.insert({c, k});
-        int2char_.insert({k, c});
-        k++;
-      }
-      nBytes = wctomb(mbs, c);
-      for (int i=0; i<nBytes; i++) {
-        str.push_back(mbs[i]);
+  for (int f=0; f<fnames.size(); f++) {
+    Utf8Reader reader(fnames[f]);
+    while (reader.read(chars) > 0) {
+      for (size_t j=0; j<chars.size(); j++) {
+        wchar_t c = chars[j];
+        if (c == '_') {
+          if (streaming) {
+            tokens_.push_back(vocab.addWord(str, 1));
+            str.clear();
+          } else {
+            text.push_back('_');
+          }
+        } else {
+          vocab.addChar(c);
+          nBytes = encodeUtf8(c, mbs);
+          std::string& dest = streaming ? str : text;
+          for (int i=0; i<nBytes; i++) {
+            dest.push_back(mbs[i]);
+          }
+        }
       }
     }
+    if (!streaming) {
+      addTrainText(text, vocab);
+    }
+    text.clear();
+    str.clear();
+    nBytesRead += reader.getNumBytes();
+    fileOffsets_.push_back(tokens_.size());
   }
-  ifs.close();
+  return nBytesRead;
+}
 
-  computeRestrictedVocabs(V1, V2);
+// decodes the files in parallel, one file per thread at a time, while they
+// are merged in file order so that the chars and words get the ids of a
+// serial read
+size_t DataProvider::decodeFiles(const std::vector<std::string>& fnames,
+                                 Vocabulary& vocab) {
+  int nWorkers = std::min(nThreads_, (int) fnames.size());
+  FileQueue queue;
+  queue.fnames = &fnames;
+  queue.shards.resize(fnames.size());
+  queue.ready.assign(fnames.size(), false);
+  queue.next = 0;
+  queue.merged = 0;
+  queue.window = 2 * nWorkers;
+  std::vector<std::thread> workers;
+  for (int w=0; w<nWorkers; w++) {
+    workers.push_back(std::thread(decodeShards, &queue));
+  }
 
+  size_t nBytes = 0;
+  for (int f=0; f<fnames.size(); f++) {
+    FileShard& shard = waitFile(&queue, f);
+    for (int i=0; i<shard.newChars.size(); i++) {
+      vocab.addChar(shard.newChars[i]);
+    }
+    WordShard& words = shard.words;
+    std::vector<int> localToGlobal(words.words.size());
+    for (int i=0; i<words.words.size(); i++) {
+      localToGlobal[i] = vocab.addWord(words.words.get(i), words.counts[i]);
+    }
+    for (int i=0; i<words.tokens.size(); i++) {
+      tokens_.push_back(localToGlobal[words.tokens[i]]);
+    }
+    nBytes += shard.nBytes;
+    fileOffsets_.push_back(tokens_.size());
+    releaseFile(&queue, f);
+  }
+  for (int w=0; w<nWorkers; w++) {
+    workers[w].join();
+  }
+  return nBytes;
+}
+
+// the files are read as a single corpus, their tokens following each other
+// in the given order
+void DataProvider::readFromFile(const std::vector<std::string>& fnames,
+                                int V1, int V2) {
+  std::cout << "Loading data from file: " << fnames[0];
+  if (fnames.size() > 1) {
+    std::cout << " and " << fnames.size() - 1 << " more";
+  }
+
+  std::string cachePath;
+  if (!cacheDir_.empty()) {
+    std::string options = "train V1=" + std::to_string(V1) +
+        " V2=" + std::to_string(V2);
+    cacheKey_ = hashString(options, hashFiles(fnames));
+    cachePath = getCachePath(fnames[0]);
+    if (loadCache(cachePath, true)) {
+      std::cout << " done." << std::endl;
+      return;
+    }
+  }
+
+  // a streamed corpus is spooled word by word, the others are decoded
+  // whole and their words counted in parallel
+  bool streaming = startSpool(fnames[0]);
+  auto tic = std::chrono::steady_clock::now();
+  std::shared_ptr<Vocabulary> vocab = std::make_shared<Vocabulary>();
+  vocab->addChar('_');
+  fileOffsets_.assign(1, 0);
+  size_t nBytes;
+  if (streaming || fnames.size() == 1) {
+    nBytes = readFiles(fnames, *vocab, streaming);
+  } else {
+    nBytes = decodeFiles(fnames, *vocab);
+  }
+  if (streaming) {
+    endSpool(fnames[0]);
+  }
+  addLoadTime(nBytes, tic);
+
+  // the vocabulary is complete, it is not modified any more
+  vocab->computeRestrictedVocabs(V1, V2);
+  vocab_ = vocab;
+
+  if (!cacheDir_.empty() && !saveCache(cachePath, true)) {
+    fprintf(stderr, "Could not write cache %s\n", cachePath.c_str());
+  }
   std::cout << " done." << std::endl;
 }
 
 void DataProvider::readFromFile(std::string fname, DataProvider& train) {
   std::cout << "Loading data from file: " << fname << std::endl;
-  word2int_ = train.word2int_;
-  int2word_ = train.int2word_;
-  wordCount_ = train.wordCount_;
-  char2int_ = train.char2int_;
-  int2char_ = train.int2char_;
-  restrictedVocab1_ = train.restrictedVocab1_;
-  restrictedVocab2_ = train.restrictedVocab2_;
-  V1_ = train.V1_;
-  V2_ = train.V2_;
-  lastIdx_ = train.lastIdx_;
-
-  std::wifstream ifs(fname);
-  wchar_t c;
+  vocab_ = train.vocab_;
+
+  // the tokens depend on the vocabulary of the training corpus
+  std::string cachePath;
+  if (!cacheDir_.empty()) {
+    cacheKey_ = hashString("eval", hashFile(fname) ^ train.cacheKey_);
+    cachePath = getCachePath(fname);
+    if (loadCache(cachePath, false)) {
+      std::cout << std::endl << "Done." << std::endl;
+      return;
+    }
+  }
+
+  bool streaming = startSpool(fname);
+  auto tic = std::chrono::steady_clock::now();
+  Utf8Reader reader(fname);
+  std::vector<wchar_t> chars;
   char mbs[16];
   int nBytes = 0;
 
-  int k = 0;
+  const CharTable& table = vocab_->getCharTable();
   std::string str;
-  while (ifs.get(c)) {
-    if (c == '_') {
-      addWord(str, false);
-      str.clear();
-    } else {
-      nBytes = wctomb(mbs, c);
-      if (char2int_.count(c)==0) {
-        printf("Unseen char! %lc : %x : ", c, c);
-        for (int i=0; i<nBytes; i++) {
-          printf("%x ", 0xff & mbs[i]);
-        }
-        printf("\n");
+  while (reader.read(chars) > 0) {
+    for (size_t j=0; j<chars.size(); j++) {
+      wchar_t c = chars[j];
+      if (c == '_') {
+        addWord(str);
+        str.clear();
       } else {
-        for (int i=0; i<nBytes; i++) {
-          str.push_back(mbs[i]);
+        nBytes = encodeUtf8(c, mbs);
+        if (table.getId(c) < 0) {
+          printf("Unseen char! %lc : %x : ", c, c);
+          for (int i=0; i<nBytes; i++) {
+            printf("%x ", 0xff & mbs[i]);
+          }
+          printf("\n");
+        } else {
+          for (int i=0; i<nBytes; i++) {
+            str.push_back(mbs[i]);
+          }
         }
       }
     }
   }
-  ifs.close();
+  if (streaming) {
+    endSpool(fname);
+  }
+  addLoadTime(reader.getNumBytes(), tic);
+
+  if (!cacheDir_.empty() && !saveCache(cachePath, false)) {
+    fprintf(stderr, "Could not write cache %s\n", cachePath.c_str());
+  }
   std::cout << "Done." << std::endl;
 }
 
-std::unordered_map<wchar_t, int>& DataProvider::getCharTable() {
-  return char2int_;
+// moves the tokens to a memory mapped file, shared with other processes
+// mapping the same file
+bool DataProvider::mapTokens(std::string fname) {
+  return tokens_.moveToFile(fname);
+}
+
+// number of bits per packed token, 0 when the tokens are not packed
+int DataProvider::getTokenBits() {
+  return tokens_.getBits();
+}
+
+// the first token of each training file followed by the number of tokens,
+// the tokens of file i are [offsets[i], offsets[i + 1])
+const std::vector<size_t>& DataProvider::getFileOffsets() {
+  return fileOffsets_;
+}
+
+// the vocabulary of the training corpus, shared by all the providers
+std::shared_ptr<const Vocabulary> DataProvider::getVocabulary() {
+  return vocab_;
 }
 
 void DataProvider::randomWord(int& wordId, std::string& word) {
-  int N = int2word_.size();
-  int id = intRand(0, N);
-  wordId = restrictedVocab1_[id];
-  word = getWord(id);
+  vocab_->randomWord(wordId, word);
 }
@@ -10,52 +10,82 @@
 #ifndef DATAPROVIDER_H
 #define DATAPROVIDER_H
 
-#include <unordered_map>
-#include <unordered_set>
 #include <string>
 #include <set>
-#include <list>
+#include <vector>
 #include <fstream>
+#include <chrono>
+#include <memory>
 #include "Utils.h"
+#include "TokenArray.h"
+#include "CacheFile.h"
+#include "Vocabulary.h"
 
 class DataProvider {
   private:
-    std::unordered_map<std::string, int> word2int_;
-    std::unordered_map<int, std::string> int2word_;
-    std::unordered_map<int, int> wordCount_;
+    std::shared_ptr<const Vocabulary> vocab_;
 
-    std::unordered_map<int, int> restrictedVocab1_;
-    std::unordered_map<int, int> restrictedVocab2_;
-    int V1_;
-    int V2_;
+    // words of a validation or test corpus missing from the vocabulary,
+    // their ids follow the ids of the vocabulary
+    WordTable oovWords_;
+    std::vector<int> oovCharIds_;
+    std::vector<size_t> oovSpanStart_;
 
-    std::unordered_set<int> outOfVocabulary_;
+    TokenArray tokens_;
 
-    std::list<int> tokens_;
-    int lastIdx_;
-    std::list<int>::iterator currIdx_;
+    // index of the first token of each training file, then the number of
+    // tokens
+    std::vector<size_t> fileOffsets_;
+
+    int nThreads_;
+    size_t currIdx_;
+    std::string cacheDir_;
+    uint64_t cacheKey_;
+    size_t streamChunk_;
+    bool packing_;
+    size_t loadBytes_;
+    double loadSeconds_;
+
+    int addWord(const std::string&);
+    void mapToken(int&, int&, const int*&, int&);
+    void addTrainText(std::string&, Vocabulary&);
+    size_t readFiles(const std::vector<std::string>&, Vocabulary&, bool);
+    size_t decodeFiles(const std::vector<std::string>&, Vocabulary&);
+    bool startSpool(std::string);
+    void endSpool(std::string);
+    void addLoadTime(size_t, std::chrono::steady_clock::time_point);
+    std::string getCachePath(std::string);
+    bool loadCache(std::string, bool);
+    bool saveCache(std::string, bool);
   public:
-    std::unordered_map<wchar_t, int> char2int_;
-    std::unordered_map<int, wchar_t> int2char_;
 
     DataProvider();
     ~DataProvider();
+    void setNumThreads(int);
+    void setCacheDir(std::string);
+    void setStreaming(size_t);
+    void setPacking(bool);
+    double getLoadSpeed();
     int getNumTokens();
     void getNumWords(int&, int&, int&);
     int getNumChars();
     int countOutOfVocab();
     int getWordId(std::string);
-    int addWord(std::string, bool);
     void printDictionary();
     void printTokens();
     void initIterator();
-    void getToken(int&, int&, std::string&);
+    void getToken(int&, int&, const int*&, int&);
+    TokenCursor getCursor(size_t, size_t);
+    void copyTokens(size_t, size_t, TokenArray&);
+    void getToken(TokenCursor&, int&, int&, const int*&, int&);
     std::string getWord(int);
     void printCharTable();
-    void computeRestrictedVocabs(int, int);
-    void readFromFile(std::string, int, int);
+    void readFromFile(const std::vector<std::string>&, int, int);
     void readFromFile(std::string, DataProvider&);
-    std::unordered_map<wchar_t, int>& getCharTable();
+    bool mapTokens(std::string);
+    int getTokenBits();
+    const std::vector<size_t>& getFileOffsets();
+    std::shared_ptr<const Vocabulary> getVocabulary();
     void randomWord(int&, std::string&);
 };
 
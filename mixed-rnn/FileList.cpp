@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "FileList.h"
+#include <glob.h>
+#include <algorithm>
+#include <random>
+
+bool isFileOrder(std::string order) {
+  return order == "given" || order == "name" || order == "shuffle";
+}
+
+// a pattern without match is kept as is, so that a missing file is
+// reported when it is read
+std::vector<std::string> listFiles(std::string spec, std::string order,
+                                   int seed) {
+  std::vector<std::string> files;
+  size_t begin = 0;
+  while (begin <= spec.size()) {
+    size_t end = spec.find(',', begin);
+    if (end == std::string::npos) {
+      end = spec.size();
+    }
+    std::string pattern = spec.substr(begin, end - begin);
+    begin = end + 1;
+    if (pattern.empty()) {
+      continue;
+    }
+    glob_t matches;
+    if (glob(pattern.c_str(), GLOB_NOCHECK, NULL, &matches) == 0) {
+      for (size_t i=0; i<matches.gl_pathc; i++) {
+        files.push_back(matches.gl_pathv[i]);
+      }
+    } else {
+      files.push_back(pattern);
+    }
+    globfree(&matches);
+  }
+
+  if (order == "name") {
+    std::sort(files.begin(), files.end());
+  } else if (order == "shuffle") {
+    std::mt19937 gen(seed);
+    std::shuffle(files.begin(), files.end(), gen);
+  }
+  return files;
+}
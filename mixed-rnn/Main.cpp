@@ -11,10 +11,16 @@
 #include "Vector.h"
 #include "Model.h"
 #include "Rnn.h"
+#include "ParallelTrainer.h"
+#include "BatchRnn.h"
+#include "ProcessTrainer.h"
+#include "ThreadPool.h"
 #include "DataProvider.h"
 #include "WordModule.h"
 #include "Utils.h"
+#include "FileList.h"
 #include <iostream>
+#include <locale>
 #include <string.h>
 #include <float.h>
 
@@ -31,10 +37,28 @@ int main(int argc, char** argv) {
   double lr = 0.005;
   double shrinkVal = 1.5;
   std::string trainFile;
+  std::string fileOrder = "given";
   std::string validFile;
   std::string testFile;
   double alpha = 0.5;
   int seed = 1;
+  int nThreads = 1;
+  int trainThreads = 1;
+  std::string parallel = "hogwild";
+  std::string numa = "none";
+  int numaSync = 10;
+  int batch = 1;
+  int procs = 1;
+  std::string averaging = "model";
+  long long averageEvery = 10000;
+  double elasticAlpha = 0.0;
+  int opThreads = 1;
+  long long opThreshold = 100000;
+  bool pipeline = false;
+  bool mmapTokens = false;
+  bool packTokens = false;
+  long long streamChunk = 0;
+  std::string cacheDir;
   char init[100];
   strcpy(init, "gaussian");
 
@@ -56,6 +80,14 @@ int main(int argc, char** argv) {
       std::string stemp(argv[ai+1]);
       trainFile = stemp;
     }
+    else if( strcmp( argv[ai], "--fileOrder") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n", argv[ai]);
+        return - 1;
+      }
+      std::string stemp(argv[ai+1]);
+      fileOrder = stemp;
+    }
     else if( strcmp( argv[ai], "--validFile") == 0){
       if (ai + 1 >= argc) {
         printf("error need argument for option %s\n", argv[ai]);
@@ -128,6 +160,129 @@ int main(int argc, char** argv) {
       }
       nepoch = atoi(argv[ai+1]);
     }
+    else if( strcmp( argv[ai], "--threads") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      nThreads = atoi(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--streamChunk") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      streamChunk = atoll(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--trainThreads") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      trainThreads = atoi(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--batch") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      batch = atoi(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--procs") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      procs = atoi(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--averaging") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      std::string stemp(argv[ai+1]);
+      averaging = stemp;
+    }
+    else if( strcmp( argv[ai], "--averageEvery") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      averageEvery = atoll(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--elasticAlpha") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      elasticAlpha = atof(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--opThreads") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      opThreads = atoi(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--opThreshold") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      opThreshold = atoll(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--pipeline") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      pipeline = strcmp(argv[ai+1], "true")==0;
+    }
+    else if( strcmp( argv[ai], "--numa") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      std::string stemp(argv[ai+1]);
+      numa = stemp;
+    }
+    else if( strcmp( argv[ai], "--numaSync") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      numaSync = atoi(argv[ai+1]);
+    }
+    else if( strcmp( argv[ai], "--parallel") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      std::string stemp(argv[ai+1]);
+      parallel = stemp;
+    }
+    else if( strcmp( argv[ai], "--mmapTokens") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      mmapTokens = strcmp(argv[ai+1], "true")==0;
+    }
+    else if( strcmp( argv[ai], "--packTokens") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      packTokens = strcmp(argv[ai+1], "true")==0;
+    }
+    else if( strcmp( argv[ai], "--cacheDir") == 0){
+      if (ai + 1 >= argc) {
+        printf("error need argument for option %s\n",argv[ai]);
+        return - 1;
+      }
+      std::string stemp(argv[ai+1]);
+      cacheDir = stemp;
+    }
     else if( strcmp( argv[ai], "--seed") == 0){
       if (ai + 1 >= argc) {
         printf("error need argument for option %s\n",argv[ai]);
@@ -157,15 +312,95 @@ int main(int argc, char** argv) {
   }
 
   srand(seed);
+  // packed tokens are private to the process, mapped ones are shared
+  if (packTokens && mmapTokens) {
+    fprintf(stderr, "--packTokens and --mmapTokens are exclusive!\n");
+    return -1;
+  }
+  if (batch > 1 && trainThreads > 1) {
+    fprintf(stderr, "--batch and --trainThreads are exclusive!\n");
+    return -1;
+  }
+  if (procs > 1 && (batch > 1 || trainThreads > 1)) {
+    fprintf(stderr, "--procs is exclusive with --batch and --trainThreads!\n");
+    return -1;
+  }
+  // the threads of the kernels are not forked with the processes
+  if (procs > 1 && opThreads > 1) {
+    fprintf(stderr, "--procs and --opThreads are exclusive!\n");
+    return -1;
+  }
+  // neither is the pipe thread, and the batch has its own char level
+  if (pipeline && (procs > 1 || batch > 1)) {
+    fprintf(stderr, "--pipeline is exclusive with --procs and --batch!\n");
+    return -1;
+  }
+  if (numa != "none" && numa != "pin" && numa != "replicate") {
+    fprintf(stderr, "Unknown numa placement %s!\n", numa.c_str());
+    return -1;
+  }
+  if (numa == "replicate" && parallel != "hogwild") {
+    fprintf(stderr, "--numa replicate needs --parallel hogwild!\n");
+    return -1;
+  }
+  if (averaging != "model" && averaging != "elastic") {
+    fprintf(stderr, "Unknown averaging %s!\n", averaging.c_str());
+    return -1;
+  }
+  if (parallel != "hogwild" && parallel != "sync") {
+    fprintf(stderr, "Unknown parallel training %s!\n", parallel.c_str());
+    return -1;
+  }
+  if (!isFileOrder(fileOrder)) {
+    fprintf(stderr, "Unknown file order %s!\n", fileOrder.c_str());
+    return -1;
+  }
 
+  // the training corpus can be split in several files, given as a comma
+  // separated list of paths and glob patterns, shuffled with the seed
+  std::vector<std::string> trainFiles = listFiles(trainFile, fileOrder, seed);
+  if (trainFiles.empty()) {
+    fprintf(stderr, "No training file in %s!\n", trainFile.c_str());
+    return -1;
+  }
   DataProvider dpTrain;
   DataProvider dpValid;
   DataProvider dpTest;
 
-  dpTrain.readFromFile(trainFile, V1, V2);
+  dpTrain.setNumThreads(nThreads);
+  dpTrain.setCacheDir(cacheDir);
+  dpValid.setCacheDir(cacheDir);
+  dpTest.setCacheDir(cacheDir);
+  dpTrain.setStreaming(streamChunk);
+  dpValid.setStreaming(streamChunk);
+  dpTest.setStreaming(streamChunk);
+  // the tokens in memory are bit-packed as they are read and decoded by
+  // blocks
+  dpTrain.setPacking(packTokens);
+  dpValid.setPacking(packTokens);
+  dpTest.setPacking(packTokens);
+  // the corpora are decoded without the locale, it is only used for printing
+  std::locale::global(std::locale(""));
+  dpTrain.readFromFile(trainFiles, V1, V2);
   dpValid.readFromFile(validFile, dpTrain);
   dpTest.readFromFile(testFile, dpTrain);
 
+  // the token files are written next to the corpus files, streamed tokens
+  // are already read from there
+  if (mmapTokens && streamChunk == 0) {
+    if (!dpTrain.mapTokens(trainFiles[0] + ".tok")
+        || !dpValid.mapTokens(validFile + ".tok")
+        || !dpTest.mapTokens(testFile + ".tok")) {
+      fprintf(stderr, "Could not memory map the token files!\n");
+      return -1;
+    }
+  }
+
+  if (dpTrain.getTokenBits() > 0) {
+    printf("packed training tokens: %d bits per token\n",
+        dpTrain.getTokenBits());
+  }
+
   // get the basic stats on the dataset
   int numWordsV0 = 0;
   int numWordsV1 = 0;
@@ -183,16 +418,52 @@ int main(int argc, char** argv) {
 
   // dpTrain.printDictionary();
 
-  // initializing the model parameters
-  Model m(nhidw, nhidc, numWordsV1, numWordsV2, numChars, alpha);
+  // initializing the model parameters, row 0 of Aw_ and Uw_ is <unk>
+  Model m(nhidw, nhidc, numWordsV1 + 1, numWordsV2 + 1, numChars, alpha);
   m.initialize(init);
   m.resetGradients();
 
-  // obtaining the character table
-  std::unordered_map<wchar_t, int> charTable = dpTrain.getCharTable();
+  // the kernels with at least opThreshold multiply-adds, the word output
+  // layer when V2 is large, are split over opThreads threads
+  ThreadPool::setKernelPool(opThreads, opThreshold);
+
+  // creating a network, sharing the character table of the training data
+  Rnn network(m, dpTrain.getVocabulary(), bptt, lr);
+  // the word and the char levels of a window can run on two threads
+  network.setPipeline(pipeline);
+
+  // with several training threads the network is only used for evaluation,
+  // the threads sharing its parameters, either updating them as they go or
+  // in lockstep; they can be pinned to the NUMA nodes, the dense parameters
+  // being replicated per node and synchronized every numaSync windows
+  trainThreads = std::max(std::min(trainThreads, dpTrain.getNumTokens()), 1);
+  std::unique_ptr<ParallelTrainer> trainer;
+  if (trainThreads > 1) {
+    trainer.reset(new ParallelTrainer(m, dpTrain.getVocabulary(),
+          trainThreads, bptt, lr, parallel == "sync", numa != "none",
+          numa == "replicate", numaSync));
+    trainer->setPipeline(pipeline);
+  }
+
+  // with a batch the streams are trained together, each on its shard
+  batch = std::max(std::min(batch, dpTrain.getNumTokens()), 1);
+  std::unique_ptr<BatchRnn> batchNetwork;
+  if (batch > 1) {
+    batchNetwork.reset(new BatchRnn(m, batch, bptt, lr));
+  }
 
-  // creating a network
-  Rnn network(m, charTable, dpTrain.int2char_, bptt, lr);
+  // with several processes each one trains its copy of the network, the
+  // copies being averaged through shared memory every averageEvery tokens,
+  // by default the elastic pull is 0.9 / procs
+  procs = std::max(std::min(procs, dpTrain.getNumTokens()), 1);
+  std::unique_ptr<ProcessTrainer> processTrainer;
+  if (procs > 1) {
+    if (elasticAlpha <= 0.0) {
+      elasticAlpha = 0.9 / procs;
+    }
+    processTrainer.reset(new ProcessTrainer(m, network, procs, averageEvery,
+          averaging == "elastic", elasticAlpha));
+  }
 
   double trainWordEntropy = 0.0;
   double validWordEntropy = 0.0;
@@ -209,10 +480,27 @@ int main(int argc, char** argv) {
 
   double trainTime = 0.0;
   for (int e=0; e<nepoch; e++) {
-    network.train(dpTrain, true, trainTime, trainWordEntropy, trainCharEntropy, nTrainChars);
+    if (trainer) {
+      trainer->train(dpTrain, trainTime, trainWordEntropy, trainCharEntropy,
+          nTrainChars);
+    } else if (processTrainer) {
+      if (!processTrainer->train(dpTrain, trainTime, trainWordEntropy,
+            trainCharEntropy, nTrainChars)) {
+        fprintf(stderr, "A training process failed!\n");
+        return -1;
+      }
+    } else if (batchNetwork) {
+      batchNetwork->train(dpTrain, trainTime, trainWordEntropy,
+          trainCharEntropy, nTrainChars);
+    } else {
+      network.train(dpTrain, true, trainTime, trainWordEntropy,
+          trainCharEntropy, nTrainChars);
+    }
     network.eval(dpValid, validWordEntropy, validCharEntropy, nValidChars);
     network.eval(dpTest, testWordEntropy, testCharEntropy, nTestChars);
     validLoss = alpha * validWordEntropy + (1.0 - alpha) * validCharEntropy;
+    // the streams of a batch leave out the last numTokens % batch tokens
+    int nTrainWords = dpTrain.getNumTokens() / batch * batch;
     printf("json_stats: {");
     printf("\"alpha\": %f, ", alpha);
     printf("\"V1\": %d, ", V1);
@@ -225,16 +513,43 @@ int main(int argc, char** argv) {
     printf("\"nhidw\": %d, ", nhidw);
     printf("\"bptt\": %d, ", bptt);
     printf("\"seed\": %d, ", seed);
+    printf("\"trainThreads\": %d, ", trainThreads);
+    printf("\"parallel\": \"%s\", ", parallel.c_str());
+    printf("\"numa\": \"%s\", ", numa.c_str());
+    printf("\"batch\": %d, ", batch);
+    printf("\"procs\": %d, ", procs);
+    printf("\"opThreads\": %d, ", opThreads);
+    printf("\"averaging\": \"%s\", ", averaging.c_str());
+    // only the processes measure how they scale
+    if (processTrainer) {
+      printf("\"scaling_efficiency\": %f, ",
+          processTrainer->getScalingEfficiency());
+      printf("\"busy_fraction\": %f, ", processTrainer->getBusyFraction());
+    }
     printf("\"lr\": %f, ", lr);
     printf("\"shrinkVal\": %f, ", shrinkVal);
     printf("\"init\": \"%s\", ", init);
     printf("\"epoch\": %d, ", e);
     printf("\"train_time\": %f, ", trainTime);
+    printf("\"train_words_per_sec\": %f, ",
+        trainTime > 0.0 ? nTrainWords / trainTime : 0.0);
+    // the speed of each NUMA node the threads run on
+    printf("\"node_words_per_sec\": [");
+    if (trainer) {
+      const std::vector<double>& speeds = trainer->getNodeSpeeds();
+      for (int k=0; k<speeds.size(); k++) {
+        printf(k > 0 ? ", %f" : "%f", speeds[k]);
+      }
+    } else {
+      printf("%f", trainTime > 0.0 ? nTrainWords / trainTime : 0.0);
+    }
+    printf("], ");
+    printf("\"load_mb_per_sec\": %f, ", dpTrain.getLoadSpeed());
     // logging train entropy
     printf("\"train_word_model_entropy\": %f, ",
-        trainWordEntropy / dpTrain.getNumTokens());
+        trainWordEntropy / nTrainWords);
     printf("\"train_word_entropy\": %f, ",
-        trainCharEntropy / dpTrain.getNumTokens());
+        trainCharEntropy / nTrainWords);
     printf("\"train_char_entropy\": %f, ", trainCharEntropy / nTrainChars);
     // logging valid entropy
     printf("\"valid_word_model_entropy\": %f, ",
@@ -253,6 +568,12 @@ int main(int argc, char** argv) {
     // checking for increase of validation entropy
     if (doShrink || (1.001 * validLoss - prevValidLoss > 0)) {
       network.updateLearningRate(shrinkVal);
+      if (trainer) {
+        trainer->updateLearningRate(shrinkVal);
+      }
+      if (batchNetwork) {
+        batchNetwork->updateLearningRate(shrinkVal);
+      }
       printf("decreasing the learning rate to %f.", network.getLr());
       std::cout << std::endl;
       doShrink = true;
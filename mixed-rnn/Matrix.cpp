@@ -9,23 +9,36 @@
 
 #include "Matrix.h"
 #include "Vector.h"
+#include "ThreadPool.h"
 #include <cblas.h>
 #include <algorithm>
+#include <math.h>
+#include <float.h>
 
 using namespace std;
 
 extern bool USE_BLAS;
 
+Matrix::Matrix() {
+  m_ = 0;
+  n_ = 0;
+  data_ = NULL;
+  ownsData_ = true;
+}
+
 Matrix::Matrix(int m, int n) {
   m_ = m;
   n_ = n;
   data_ = new double[m*n];
+  ownsData_ = true;
 }
 
+// copying a view gives a matrix owning a copy of the viewed rows
 Matrix::Matrix(const Matrix& a) {
   m_ = a.m_;
   n_ = a.n_;
   data_ = new double[m_ * n_];
+  ownsData_ = true;
   for (int i=0; i<m_; i++) {
     for (int j=0; j<n_; j++) {
       data_[i * n_ + j] = a.data_[i * n_ + j];
@@ -34,7 +47,21 @@ Matrix::Matrix(const Matrix& a) {
 }
 
 Matrix::~Matrix() {
-  delete[] data_;
+  if (ownsData_) {
+    delete[] data_;
+  }
+}
+
+// makes this matrix a view on the rows [i, i + m) of matrix a
+void Matrix::setView(Matrix& a, int i, int m) {
+  assert(i >= 0 && i + m <= a.m_);
+  if (ownsData_) {
+    delete[] data_;
+  }
+  m_ = m;
+  n_ = a.n_;
+  data_ = a.data_ + (size_t) i * a.n_;
+  ownsData_ = false;
 }
 
 void Matrix::fillRandom() {
@@ -214,18 +241,139 @@ void Matrix::addMatrices(Matrix& a, Matrix& b) {
   }
 }
 
+// rank one update A += a * b * c^T of the m rows of A of length n
+static void vectorVectorTRows(double a, double* b, int m, double* c, int n,
+                              double* A) {
+  if (USE_BLAS) {
+    cblas_dger(CblasRowMajor, m, n, a, b, 1, c, 1, A, n);
+  } else {
+    for (int i=0; i<m; i++) {
+      for (int j=0; j<n; j++) {
+        A[i * n + j] += a * b[i] * c[j];
+      }
+    }
+  }
+}
+
 void Matrix::vectorVectorT(double a, Vector& vecB, Vector& vecC) {
   assert(m_ == vecB.m_);
   assert(n_ == vecC.m_);
+  if (!ThreadPool::isSplit((long long) m_ * n_)) {
+    vectorVectorTRows(a, vecB.data_, m_, vecC.data_, n_, data_);
+    return;
+  }
+  ThreadPool* pool = ThreadPool::acquire();
+  ThreadPool::split(pool, m_, ThreadPool::getChunkRows(n_),
+      [this, a, &vecB, &vecC](int /*chunk*/, int begin, int end) {
+      vectorVectorTRows(a, vecB.data_ + begin, end - begin, vecC.data_, n_,
+          data_ + (size_t) begin * n_);
+  });
+  if (pool != NULL) {
+    pool->release();
+  }
+}
+
+
+// computes the GEMM this = a * op(A) * op(B) + d * this, op transposing the
+// matrix before it when its flag is true
+void Matrix::matrixMatrix(double a, Matrix& A, bool transA,
+                          Matrix& B, bool transB, double d) {
+  int k = transA ? A.m_ : A.n_;
+  assert(m_ == (transA ? A.n_ : A.m_));
+  assert(n_ == (transB ? B.m_ : B.n_));
+  assert(k == (transB ? B.n_ : B.m_));
   if (USE_BLAS) {
-    cblas_dger(CblasRowMajor, vecB.m_, vecC.m_, a, vecB.data_, 1,
-        vecC.data_, 1, data_, n_);
-  } else {
-    for (int i=0; i<m_; i++) {
+    cblas_dgemm(CblasRowMajor, transA ? CblasTrans : CblasNoTrans,
+        transB ? CblasTrans : CblasNoTrans, m_, n_, k, a, A.data_,
+        std::max(A.n_, 1), B.data_, std::max(B.n_, 1), d, data_,
+        std::max(n_, 1));
+    return;
+  }
+
+  // as in BLAS this is not read when d is 0, it may be uninitialized
+  if (d == 0.0) {
+    fillValue(0.0);
+  } else if (d != 1.0) {
+    scale(d);
+  }
+  for (int i=0; i<m_; i++) {
+    double* row = data_ + (size_t) i * n_;
+    if (transB && !transA) {
+      // rows of A and B are dotted
+      const double* r = A.data_ + (size_t) i * A.n_;
       for (int j=0; j<n_; j++) {
-        data_[i * n_ + j] += a * vecB.data_[i] * vecC.data_[j];
+        const double* b = B.data_ + (size_t) j * B.n_;
+        double val = 0.0;
+        for (int l=0; l<k; l++) {
+          val += r[l] * b[l];
+        }
+        row[j] += a * val;
+      }
+    } else if (transB) {
+      for (int j=0; j<n_; j++) {
+        const double* b = B.data_ + (size_t) j * B.n_;
+        double val = 0.0;
+        for (int l=0; l<k; l++) {
+          val += A.data_[(size_t) l * A.n_ + i] * b[l];
+        }
+        row[j] += a * val;
+      }
+    } else {
+      // rows of B are accumulated
+      for (int l=0; l<k; l++) {
+        double x = a * (transA ? A.data_[(size_t) l * A.n_ + i] :
+            A.data_[(size_t) i * A.n_ + l]);
+        const double* b = B.data_ + (size_t) l * B.n_;
+        for (int j=0; j<n_; j++) {
+          row[j] += x * b[j];
+        }
       }
     }
   }
 }
 
+void Matrix::sigmoid() {
+  for (int i=0; i<m_; i++) {
+    for (int j=0; j<n_; j++) {
+      data_[i * n_ + j] = 1.0 / (1 + exp(-data_[i * n_ + j]));
+    }
+  }
+}
+
+void Matrix::aTimesOneMinusA() {
+  for (int i=0; i<m_; i++) {
+    for (int j=0; j<n_; j++) {
+      data_[i * n_ + j] = data_[i * n_ + j] * (1.0 - data_[i * n_ + j]);
+    }
+  }
+}
+
+// in place update as this = this * b
+void Matrix::timesInPlace(Matrix& b) {
+  assert(m_ == b.m_);
+  assert(n_ == b.n_);
+  for (int i=0; i<m_; i++) {
+    for (int j=0; j<n_; j++) {
+      data_[i * n_ + j] *= b.data_[i * n_ + j];
+    }
+  }
+}
+
+// applies the softmax to each row
+void Matrix::softMaxRows() {
+  for (int i=0; i<m_; i++) {
+    double* row = data_ + (size_t) i * n_;
+    double M = -DBL_MAX;
+    for (int j=0; j<n_; j++) {
+      M = std::max(M, row[j]);
+    }
+    double sum = 0.0;
+    for (int j=0; j<n_; j++) {
+      row[j] = exp(row[j] - M);
+      sum += row[j];
+    }
+    for (int j=0; j<n_; j++) {
+      row[j] /= sum;
+    }
+  }
+}
@@ -18,9 +18,11 @@ class Vector;
 
 class Matrix {
   public:
+    Matrix();
     Matrix(int, int);
     Matrix(const Matrix&);
     ~Matrix();
+    void setView(Matrix&, int, int);
     void fillRandom();
     void fillRandom(double);
     void fillRandn();
@@ -44,9 +46,19 @@ class Matrix {
 
     void addMatrices(Matrix&, Matrix&);
     void vectorVectorT(double, Vector&, Vector&);
+    void matrixMatrix(double, Matrix&, bool, Matrix&, bool, double);
+
+    // row-wise and element-wise operations
+    void sigmoid();
+    void aTimesOneMinusA();
+    void timesInPlace(Matrix&);
+    void softMaxRows();
+
     double* data_;
     int m_;
     int n_;
+    // false for views on the rows of another matrix
+    bool ownsData_;
 };
 
 #endif
@@ -17,6 +17,18 @@ Model::Model(int mWord,
             int dWordV2,
             int dChar,
             double alpha)
+    : Model(mWord, mChar, dWordV1, dWordV2, dChar, alpha, true) {
+}
+
+// without wordGradients gAw_ has no rows, for a model only holding
+// parameters
+Model::Model(int mWord,
+             int mChar,
+             int dWordV1,
+             int dWordV2,
+             int dChar,
+             double alpha,
+             bool wordGradients)
     : Rw_(mWord, mWord),
       Aw_(dWordV1, mWord), // storing the transpose for efficient lookup
       Uw_(dWordV2, mWord),
@@ -26,7 +38,7 @@ Model::Model(int mWord,
       Ic_(mChar, mWord),
       Q_(mChar, mWord),
       gRw_(mWord, mWord),
-      gAw_(dWordV1, mWord),
+      gAw_(wordGradients ? dWordV1 : 0, mWord),
       gUw_(dWordV2, mWord),
       gRc_(mChar, mChar),
       gAc_(dChar, mChar),
@@ -48,6 +60,32 @@ Model::Model(int mWord,
   dwV2 = dWordV2;
   dc = dChar;
   alpha_ = alpha;
+
+  // resetGradients only wipes the rows of the updated words
+  gAw_.fillValue(0.0);
+}
+
+// a model training the parameters of another one from its own thread, its
+// parameters are views on those of params and only its gradients are
+// allocated, the deltas of the gradient check are left empty
+Model::Model(Model* params)
+    : gRw_(params->mw, params->mw),
+      gAw_(params->dwV1, params->mw),
+      gUw_(params->dwV2, params->mw),
+      gRc_(params->mc, params->mc),
+      gAc_(params->dc, params->mc),
+      gUc_(params->dc, params->mc),
+      gIc_(params->mc, params->mw),
+      gQ_(params->mc, params->mw) {
+  mw = params->mw;
+  mc = params->mc;
+  dwV1 = params->dwV1;
+  dwV2 = params->dwV2;
+  dc = params->dc;
+  alpha_ = params->alpha_;
+  shareParameters(*params);
+
+  gAw_.fillValue(0.0);
 }
 
 Model::Model(const Model& other)
@@ -117,6 +155,40 @@ void Model::copy(Model& other) {
   alpha_ = other.alpha_;
 }
 
+// makes the parameters views on those of another model, keeping the
+// gradients and deltas private, so that several threads train the same
+// parameters
+void Model::shareParameters(Model& other) {
+  Rw_.setView(other.Rw_, 0, other.Rw_.m_);
+  Aw_.setView(other.Aw_, 0, other.Aw_.m_);
+  Uw_.setView(other.Uw_, 0, other.Uw_.m_);
+
+  Rc_.setView(other.Rc_, 0, other.Rc_.m_);
+  Ac_.setView(other.Ac_, 0, other.Ac_.m_);
+  Uc_.setView(other.Uc_, 0, other.Uc_.m_);
+
+  Ic_.setView(other.Ic_, 0, other.Ic_.m_);
+  Q_.setView(other.Q_, 0, other.Q_.m_);
+}
+
+// makes the word embeddings Aw_ a view on those of another model, the
+// other parameters staying private
+void Model::shareWordParameters(Model& other) {
+  Aw_.setView(other.Aw_, 0, other.Aw_.m_);
+}
+
+// the parameters updated densely, that is all of them but Aw_
+void Model::getDenseParameters(std::vector<Matrix*>& params) {
+  params.clear();
+  params.push_back(&Rw_);
+  params.push_back(&Uw_);
+  params.push_back(&Rc_);
+  params.push_back(&Ac_);
+  params.push_back(&Uc_);
+  params.push_back(&Ic_);
+  params.push_back(&Q_);
+}
+
 void Model::resetGradients() {
   gRw_.fillValue(0.0);
 
@@ -138,6 +210,28 @@ void Model::resetGradients() {
   gQ_.fillValue(0.0);
 }
 
+// adds the gradients of another model, on the rows of Aw_ of the words it
+// updated only
+void Model::addGradients(Model& other) {
+  gRw_.addInPlace(other.gRw_);
+
+  for (auto it=other.updatedWordsList_.begin();
+       it!=other.updatedWordsList_.end(); ++it) {
+    gAw_.addRow(*it, 1.0, other.gAw_);
+    updatedWordsList_.insert(*it);
+  }
+  if (alpha_ > 0.01) {
+    gUw_.addInPlace(other.gUw_);
+  }
+
+  gRc_.addInPlace(other.gRc_);
+  gAc_.addInPlace(other.gAc_);
+  gUc_.addInPlace(other.gUc_);
+
+  gIc_.addInPlace(other.gIc_);
+  gQ_.addInPlace(other.gQ_);
+}
+
 void Model::resetDeltas() {
   dRw_.fillValue(0.0);
   dAw_.fillValue(0.0);
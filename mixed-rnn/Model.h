@@ -58,10 +58,16 @@ class Model {
     Matrix dQ_;
 
     Model(int, int, int, int, int, double);
+    Model(int, int, int, int, int, double, bool);
+    explicit Model(Model*);
     Model(const Model&);
     ~Model();
     void copy(Model&);
+    void shareParameters(Model&);
+    void shareWordParameters(Model&);
+    void getDenseParameters(std::vector<Matrix*>&);
     void resetGradients();
+    void addGradients(Model&);
     void resetDeltas();
     void update(double);
     void initialize(char*);
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "Numa.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <fstream>
+#include <string>
+
+// parses a list of ids and ranges such as "0-3,8,10-11"
+static std::vector<int> parseList(const std::string& list) {
+  std::vector<int> ids;
+  size_t begin = 0;
+  while (begin < list.size()) {
+    size_t end = list.find(',', begin);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    std::string range = list.substr(begin, end - begin);
+    size_t dash = range.find('-');
+    if (!range.empty()) {
+      int first = atoi(range.c_str());
+      int last = dash == std::string::npos ? first :
+          atoi(range.c_str() + dash + 1);
+      for (int i=first; i<=last; i++) {
+        ids.push_back(i);
+      }
+    }
+    begin = end + 1;
+  }
+  return ids;
+}
+
+static bool readLine(std::string path, std::string& line) {
+  std::ifstream in(path);
+  return (bool) std::getline(in, line);
+}
+
+std::vector<std::vector<int>> getNumaNodes() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return std::vector<std::vector<int>>();
+  }
+
+  std::vector<std::vector<int>> nodes;
+  std::string root = "/sys/devices/system/node/";
+  std::string online;
+  if (readLine(root + "online", online)) {
+    std::vector<int> nodeIds = parseList(online);
+    for (int i=0; i<nodeIds.size(); i++) {
+      std::string list;
+      if (!readLine(root + "node" + std::to_string(nodeIds[i]) + "/cpulist",
+          list)) {
+        continue;
+      }
+      std::vector<int> cpus;
+      std::vector<int> ids = parseList(list);
+      for (int j=0; j<ids.size(); j++) {
+        if (ids[j] < CPU_SETSIZE && CPU_ISSET(ids[j], &allowed)) {
+          cpus.push_back(ids[j]);
+        }
+      }
+      if (!cpus.empty()) {
+        nodes.push_back(cpus);
+      }
+    }
+  }
+  if (nodes.empty()) {
+    std::vector<int> cpus;
+    for (int i=0; i<CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &allowed)) {
+        cpus.push_back(i);
+      }
+    }
+    nodes.push_back(cpus);
+  }
+  return nodes;
+}
+
+// restricts the calling thread to a CPU
+bool pinThread(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// restricts the calling thread to a set of CPUs
+bool pinThread(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int i=0; i<cpus.size(); i++) {
+    CPU_SET(cpus[i], &set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
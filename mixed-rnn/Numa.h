@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <vector>
+
+// The CPUs of each NUMA node the process may run on, read from
+// /sys/devices/system/node. Without this topology all the allowed CPUs
+// form a single node. A pinned thread allocates on its node the pages it
+// touches first.
+std::vector<std::vector<int>> getNumaNodes();
+bool pinThread(int);
+bool pinThread(const std::vector<int>&);
+
+#endif
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ParallelTrainer.h"
+#include "Numa.h"
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+ParallelTrainer::ParallelTrainer(Model& modelRef,
+                                 std::shared_ptr<const Vocabulary> vocab,
+                                 int nThreads, int T, double learningRate,
+                                 bool sync, bool pin, bool replicate,
+                                 int syncWindows)
+    : model_(modelRef),
+      vocab_(vocab),
+      models_(nThreads),
+      nets_(nThreads),
+      localTokens_(nThreads),
+      seconds_(nThreads, 0.0) {
+  assert(!(sync && replicate));
+  T_ = T;
+  lr_ = learningRate;
+  sync_ = sync;
+  replicate_ = replicate;
+  pipeline_ = false;
+  nWaiting_ = 0;
+  generation_ = 0;
+  syncWindows_ = std::max(syncWindows, 1);
+
+  // the threads are spread over the nodes in blocks of consecutive threads,
+  // and over the CPUs of their node
+  nNodes_ = 1;
+  nodes_.assign(nThreads, 0);
+  std::vector<std::vector<int>> nodes;
+  if (pin) {
+    nodes = getNumaNodes();
+  }
+  if (!nodes.empty()) {
+    nNodes_ = std::min((int) nodes.size(), nThreads);
+    nodeCpus_.assign(nodes.begin(), nodes.begin() + nNodes_);
+    std::vector<int> nPlaced(nNodes_, 0);
+    for (int t=0; t<nThreads; t++) {
+      int node = t * nNodes_ / nThreads;
+      std::vector<int>& cpus = nodes[node];
+      nodes_[t] = node;
+      cpus_.push_back(cpus[nPlaced[node] % cpus.size()]);
+      nPlaced[node]++;
+    }
+  }
+  nodeSpeeds_.assign(nNodes_, 0.0);
+
+  // the replicas hold no word gradients, their threads have their own
+  if (replicate) {
+    replicas_.resize(nNodes_);
+    bases_.resize(nNodes_);
+  }
+  if (cpus_.empty()) {
+    for (int n=0; n<replicas_.size(); n++) {
+      replicas_[n].reset(new Model(modelRef.mw, modelRef.mc, modelRef.dwV1,
+          modelRef.dwV2, modelRef.dc, modelRef.alpha_, false));
+      replicas_[n]->shareWordParameters(modelRef);
+    }
+    for (int t=0; t<nThreads; t++) {
+      createNetwork(t);
+    }
+  }
+}
+
+// the model of thread t, sharing the parameters of its replica or of the
+// model, and its network
+void ParallelTrainer::createNetwork(int t) {
+  Model& params = replicate_ ? *replicas_[nodes_[t]] : model_;
+  models_[t].reset(new Model(&params));
+  models_[t]->resetGradients();
+  nets_[t].reset(new Rnn(*models_[t], vocab_, T_, lr_));
+  nets_[t]->setUpdate(!sync_);
+  nets_[t]->setPipeline(pipeline_);
+}
+
+// whether the networks pipeline their windows, including the ones the
+// pinned threads create later
+void ParallelTrainer::setPipeline(bool pipeline) {
+  pipeline_ = pipeline;
+  for (int t=0; t<nets_.size(); t++) {
+    if (nets_[t]) {
+      nets_[t]->setPipeline(pipeline);
+    }
+  }
+}
+
+void ParallelTrainer::updateLearningRate(double shrinkVal) {
+  for (int t=0; t<nets_.size(); t++) {
+    if (nets_[t]) {
+      nets_[t]->updateLearningRate(shrinkVal);
+    }
+  }
+}
+
+// waits for all the threads to reach it
+void ParallelTrainer::barrier() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  int generation = generation_;
+  nWaiting_++;
+  if (nWaiting_ == nets_.size()) {
+    nWaiting_ = 0;
+    generation_++;
+    cv_.notify_all();
+  } else {
+    cv_.wait(lock, [this, generation] { return generation_ != generation; });
+  }
+}
+
+// runs nRounds rounds of thread t, a round being one window per thread, the
+// sum of the gradients of the round and its update by thread 0
+void ParallelTrainer::syncWorker(int t, DataProvider* dp, TokenCursor* cursor,
+                                 int nRounds, double* wordEntropy,
+                                 double* charEntropy, int* nChars) {
+  int n = nets_.size();
+  Rnn& net = *nets_[t];
+  size_t remaining = cursor->size();
+  for (int r=0; r<nRounds; r++) {
+    size_t nRead = net.trainWindow(*dp, *cursor, remaining, *wordEntropy,
+        *charEntropy, *nChars);
+    remaining -= nRead;
+    // without a complete window the gradients of the last round are left
+    if (nRead == 0 || net.getStep() != 0) {
+      models_[t]->resetGradients();
+    }
+    barrier();
+
+    for (int stride=1; stride<n; stride*=2) {
+      if (t % (2 * stride) == 0 && t + stride < n) {
+        models_[t]->addGradients(*models_[t + stride]);
+      }
+      barrier();
+    }
+    if (t == 0) {
+      models_[0]->update(net.getLr() / net.getT());
+    }
+    barrier();
+  }
+}
+
+// copies the dense parameters of the model to the replica of a node
+void ParallelTrainer::resetReplica(int node) {
+  std::vector<Matrix*> params;
+  std::vector<Matrix*> replica;
+  model_.getDenseParameters(params);
+  replicas_[node]->getDenseParameters(replica);
+  std::vector<double>& base = bases_[node];
+  base.clear();
+  for (int i=0; i<params.size(); i++) {
+    replica[i]->copy(*params[i]);
+    base.insert(base.end(), replica[i]->data_,
+        replica[i]->data_ + (size_t) replica[i]->m_ * replica[i]->n_);
+  }
+}
+
+// adds the changes of the replica of a node since its last synchronization
+// to the model, then copies the model to the replica
+void ParallelTrainer::syncReplica(int node) {
+  std::vector<Matrix*> params;
+  std::vector<Matrix*> replica;
+  model_.getDenseParameters(params);
+  replicas_[node]->getDenseParameters(replica);
+  std::lock_guard<std::mutex> lock(mutex_);
+  double* base = bases_[node].data();
+  for (int i=0; i<params.size(); i++) {
+    size_t n = (size_t) params[i]->m_ * params[i]->n_;
+    double* r = replica[i]->data_;
+    double* m = params[i]->data_;
+    for (size_t j=0; j<n; j++) {
+      m[j] += r[j] - base[j];
+      r[j] = m[j];
+      base[j] = m[j];
+    }
+    base += n;
+  }
+}
+
+// trains thread t on its shard without locks, the first thread of a node
+// synchronizing its replica every syncWindows_ windows
+void ParallelTrainer::hogwildWorker(int t, DataProvider* dp,
+                                    TokenCursor* cursor, double* wordEntropy,
+                                    double* charEntropy, int* nChars) {
+  Rnn& net = *nets_[t];
+  bool leader = replicate_ && (t == 0 || nodes_[t - 1] != nodes_[t]);
+  int nWindows = 0;
+  size_t remaining = cursor->size();
+  while (remaining > 0) {
+    remaining -= net.trainWindow(*dp, *cursor, remaining, *wordEntropy,
+        *charEntropy, *nChars);
+    if (leader && net.getStep() == 0 && ++nWindows % syncWindows_ == 0) {
+      syncReplica(nodes_[t]);
+    }
+  }
+}
+
+// runs thread t over the tokens [begin, end), pinned to its CPU if any
+void ParallelTrainer::worker(int t, DataProvider* dp, size_t begin,
+                             size_t end, int nRounds, double* wordEntropy,
+                             double* charEntropy, int* nChars) {
+  TokenCursor cursor = dp->getCursor(begin, end);
+  bool leader = t == 0 || nodes_[t - 1] != nodes_[t];
+  if (!cpus_.empty()) {
+    // the shard, the replica of the node and the network of the thread are
+    // created by the thread on the CPUs of its node, so that they are
+    // allocated on it and that the pipe thread is not bound to its CPU
+    pinThread(nodeCpus_[nodes_[t]]);
+    if (!localTokens_[t]) {
+      localTokens_[t].reset(new TokenArray());
+      dp->copyTokens(begin, end, *localTokens_[t]);
+    }
+    cursor = TokenCursor(*localTokens_[t], 0, end - begin);
+    if (!nets_[t]) {
+      if (replicate_) {
+        if (leader) {
+          replicas_[nodes_[t]].reset(new Model(model_.mw, model_.mc,
+              model_.dwV1, model_.dwV2, model_.dc, model_.alpha_, false));
+          replicas_[nodes_[t]]->shareWordParameters(model_);
+        }
+        barrier();
+      }
+      createNetwork(t);
+    }
+    pinThread(cpus_[t]);
+  }
+
+  if (replicate_) {
+    if (leader) {
+      resetReplica(nodes_[t]);
+    }
+    barrier();
+  }
+  // the sums are kept on the stack of the thread and stored once, the
+  // slots of the threads share cache lines
+  double localWordEntropy = 0.0;
+  double localCharEntropy = 0.0;
+  int localChars = 0;
+  // the speed of the node only counts the training, not the copy of the
+  // shard, the creation of the network or the last sync of the replica
+  auto tic = std::chrono::steady_clock::now();
+  if (sync_) {
+    syncWorker(t, dp, &cursor, nRounds, &localWordEntropy, &localCharEntropy,
+        &localChars);
+  } else {
+    hogwildWorker(t, dp, &cursor, &localWordEntropy, &localCharEntropy,
+        &localChars);
+  }
+  auto toc = std::chrono::steady_clock::now();
+  seconds_[t] = std::chrono::duration<double>(toc - tic).count();
+  if (replicate_) {
+    barrier();
+    if (leader) {
+      syncReplica(nodes_[t]);
+    }
+  }
+  *wordEntropy = localWordEntropy;
+  *charEntropy = localCharEntropy;
+  *nChars = localChars;
+}
+
+// splits the tokens in n contiguous shards, on the file boundaries nearest
+// to an even split when they leave no shard empty
+std::vector<size_t> ParallelTrainer::getShardBounds(
+    const std::vector<size_t>& fileOffsets, int n) {
+  size_t nTokens = fileOffsets.back();
+  std::vector<size_t> bounds(1, 0);
+  for (int s=1; s<n; s++) {
+    size_t target = nTokens * s / n;
+    auto it = std::lower_bound(fileOffsets.begin(), fileOffsets.end(),
+        target);
+    if (it != fileOffsets.begin() && target - *(it - 1) < *it - target) {
+      --it;
+    }
+    bounds.push_back(*it);
+  }
+  bounds.push_back(nTokens);
+  for (int s=0; s<n; s++) {
+    if (bounds[s] >= bounds[s + 1]) {
+      for (int k=1; k<n; k++) {
+        bounds[k] = nTokens * k / n;
+      }
+      break;
+    }
+  }
+  return bounds;
+}
+
+// one pass over the training tokens, the entropies and the number of chars
+// are summed over the threads
+void ParallelTrainer::train(DataProvider& dp,
+                            double& seconds,
+                            double& wordEntropy,
+                            double& charEntropy,
+                            int& nChars) {
+  int n = nets_.size();
+  std::vector<size_t> bounds = getShardBounds(dp.getFileOffsets(), n);
+  std::vector<double> wordEntropies(n, 0.0);
+  std::vector<double> charEntropies(n, 0.0);
+  std::vector<int> charCounts(n, 0);
+
+  // the threads of the synchronous mode go on until the longest shard is
+  // read, the first window of a shard completing the last one of the epoch
+  // before
+  int nRounds = 0;
+  for (int t=0; t<n; t++) {
+    int step = nets_[t] ? nets_[t]->getStep() : 0;
+    size_t nTokens = step + bounds[t + 1] - bounds[t];
+    nRounds = std::max(nRounds, (int) ((nTokens + T_ - 1) / T_));
+  }
+
+  auto tic = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (int t=0; t<n; t++) {
+    workers.push_back(std::thread(&ParallelTrainer::worker, this, t, &dp,
+          bounds[t], bounds[t + 1], nRounds, &wordEntropies[t],
+          &charEntropies[t], &charCounts[t]));
+  }
+  for (int t=0; t<n; t++) {
+    workers[t].join();
+  }
+  auto toc = std::chrono::steady_clock::now();
+  seconds = std::chrono::duration_cast<std::chrono::milliseconds>
+      (toc - tic).count() / 1000.0;
+
+  wordEntropy = 0.0;
+  charEntropy = 0.0;
+  nChars = 0;
+  for (int t=0; t<n; t++) {
+    wordEntropy += wordEntropies[t];
+    charEntropy += charEntropies[t];
+    nChars += charCounts[t];
+  }
+
+  // a node reads the shards of its threads until the last one is done
+  std::vector<size_t> nodeTokens(nNodes_, 0);
+  std::vector<double> nodeSeconds(nNodes_, 0.0);
+  for (int t=0; t<n; t++) {
+    nodeTokens[nodes_[t]] += bounds[t + 1] - bounds[t];
+    nodeSeconds[nodes_[t]] = std::max(nodeSeconds[nodes_[t]], seconds_[t]);
+  }
+  for (int k=0; k<nNodes_; k++) {
+    nodeSpeeds_[k] = nodeSeconds[k] > 0.0 ? nodeTokens[k] / nodeSeconds[k]
+        : 0.0;
+  }
+}
+
+// words per second of each node in the last epoch
+const std::vector<double>& ParallelTrainer::getNodeSpeeds() {
+  return nodeSpeeds_;
+}
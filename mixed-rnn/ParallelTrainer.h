@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef PARALLELTRAINER_H
+#define PARALLELTRAINER_H
+
+#include "Model.h"
+#include "Rnn.h"
+#include "DataProvider.h"
+#include "Vocabulary.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+// Trains a model with several threads, each running the BPTT of its own Rnn
+// over a contiguous shard of the training tokens. The threads share the
+// parameters of the model and have their own gradients.
+//
+// With Hogwild the threads update the parameters without locks, the dense
+// matrices as a whole and the rows of the words they saw in Aw_. In the
+// synchronous mode every thread computes the gradients of one window, they
+// are summed in a binary tree (the rows of Aw_ sparsely) and applied once,
+// so that a run only depends on the seed and the number of threads.
+//
+// The threads can be pinned to the CPUs of the NUMA nodes, in blocks of
+// consecutive threads per node, each copying its shard of the tokens so
+// that it is allocated on its node. With Hogwild the dense parameters can
+// also be replicated per node, the threads of a node updating its replica
+// and the first of them pushing the changes of the replica to the model
+// and pulling those of the other nodes every few windows. The networks and
+// the replicas of pinned threads are created by these threads in the first
+// epoch, so that their memory is allocated on their node, and the pipe
+// threads of pipelined networks may run on any CPU of the node.
+class ParallelTrainer {
+  private:
+    Model& model_;
+    std::shared_ptr<const Vocabulary> vocab_;
+    int T_;
+    double lr_;
+    std::vector<std::unique_ptr<Model>> models_;
+    std::vector<std::unique_ptr<Rnn>> nets_;
+    bool sync_;
+    bool replicate_;
+    bool pipeline_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int nWaiting_;
+    int generation_;
+
+    // placement, cpus_ is empty when the threads are not pinned
+    std::vector<int> cpus_;
+    std::vector<std::vector<int>> nodeCpus_;
+    std::vector<int> nodes_;
+    int nNodes_;
+    std::vector<std::unique_ptr<TokenArray>> localTokens_;
+    std::vector<double> seconds_;
+    std::vector<double> nodeSpeeds_;
+
+    // replicas of the dense parameters per node, with their values at the
+    // last synchronization
+    std::vector<std::unique_ptr<Model>> replicas_;
+    std::vector<std::vector<double>> bases_;
+    int syncWindows_;
+
+    void barrier();
+    void syncWorker(int, DataProvider*, TokenCursor*, int, double*, double*,
+                    int*);
+    void hogwildWorker(int, DataProvider*, TokenCursor*, double*, double*,
+                       int*);
+    void worker(int, DataProvider*, size_t, size_t, int, double*, double*,
+                int*);
+    void createNetwork(int);
+    void resetReplica(int);
+    void syncReplica(int);
+
+  public:
+    ParallelTrainer(Model&, std::shared_ptr<const Vocabulary>, int, int,
+                    double, bool, bool, bool, int);
+    void updateLearningRate(double);
+    void setPipeline(bool);
+    void train(DataProvider&, double&, double&, double&, int&);
+    const std::vector<double>& getNodeSpeeds();
+    static std::vector<size_t> getShardBounds(const std::vector<size_t>&,
+                                              int);
+};
+
+#endif
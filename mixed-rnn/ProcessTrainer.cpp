@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ProcessTrainer.h"
+#include "ParallelTrainer.h"
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+
+// tokens trained by a single process to measure the serial speed
+static const size_t SERIAL_TOKENS = 20000;
+
+// the parts of the shared segment start on cache lines
+static size_t alignUp(size_t n) {
+  return (n + 63) / 64 * 64;
+}
+
+ProcessTrainer::ProcessTrainer(Model& modelRef, Rnn& net, int nProcs,
+                               size_t syncTokens, bool elastic,
+                               double elasticAlpha)
+    : model_(modelRef),
+      net_(net) {
+  nProcs_ = nProcs;
+  syncTokens_ = std::max(syncTokens, (size_t) 1);
+  elastic_ = elastic;
+  elasticAlpha_ = elasticAlpha;
+  busyFraction_ = 0.0;
+  scalingEfficiency_ = 0.0;
+  serialSpeed_ = 0.0;
+
+  model_.getDenseParameters(dense_);
+  nDense_ = 0;
+  for (int i=0; i<dense_.size(); i++) {
+    nDense_ += (size_t) dense_[i]->m_ * dense_[i]->n_;
+  }
+  nParams_ = nDense_ + (size_t) model_.Aw_.m_ * model_.Aw_.n_;
+
+  // the pages of the slots are only allocated when written, so the rows of
+  // Aw_ never updated cost nothing
+  size_t statsOffset = alignUp(sizeof(SharedBarrier));
+  size_t flagsOffset = statsOffset + alignUp(nProcs_ * sizeof(ProcessStats));
+  size_t centerOffset = flagsOffset + alignUp(model_.Aw_.m_);
+  size_t slotsOffset = centerOffset + alignUp(nParams_ * sizeof(double));
+  sharedBytes_ = slotsOffset + nProcs_ * nParams_ * sizeof(double);
+  shared_ = mmap(NULL, sharedBytes_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared_ == MAP_FAILED) {
+    fprintf(stderr, "Could not map %zu bytes of shared memory!\n",
+        sharedBytes_);
+    shared_ = NULL;
+    return;
+  }
+  char* base = (char*) shared_;
+  barrier_ = (SharedBarrier*) base;
+  stats_ = (ProcessStats*) (base + statsOffset);
+  rowFlags_ = (unsigned char*) (base + flagsOffset);
+  center_ = (double*) (base + centerOffset);
+  slots_ = (double*) (base + slotsOffset);
+
+  // the mutex is robust, a process dying while holding it does not block
+  // the others
+  pthread_mutexattr_t mutexAttr;
+  pthread_mutexattr_init(&mutexAttr);
+  pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mutexAttr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&barrier_->mutex, &mutexAttr);
+  pthread_mutexattr_destroy(&mutexAttr);
+  pthread_condattr_t condAttr;
+  pthread_condattr_init(&condAttr);
+  pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+  pthread_cond_init(&barrier_->cond, &condAttr);
+  pthread_condattr_destroy(&condAttr);
+}
+
+ProcessTrainer::~ProcessTrainer() {
+  if (shared_ != NULL) {
+    pthread_cond_destroy(&barrier_->cond);
+    pthread_mutex_destroy(&barrier_->mutex);
+    munmap(shared_, sharedBytes_);
+  }
+}
+
+// a previous owner of the mutex died, so did its process
+void ProcessTrainer::lockBarrier() {
+  if (pthread_mutex_lock(&barrier_->mutex) == EOWNERDEAD) {
+    barrier_->aborted = 1;
+    pthread_mutex_consistent(&barrier_->mutex);
+  }
+}
+
+// whether a child exited, which it only does after the last barrier of
+// the epoch, so in any barrier of the calling process it failed
+bool ProcessTrainer::childFailed() {
+  for (int c=0; c<children_.size(); c++) {
+    if (children_[c] > 0 && waitpid(children_[c], NULL, WNOHANG) != 0) {
+      children_[c] = -1;
+      return true;
+    }
+  }
+  return false;
+}
+
+// barrier of process k, false when aborted; the calling process checks its
+// children while it waits
+bool ProcessTrainer::barrier(int k) {
+  lockBarrier();
+  if (barrier_->aborted) {
+    pthread_mutex_unlock(&barrier_->mutex);
+    return false;
+  }
+  int generation = barrier_->generation;
+  if (++barrier_->count == nProcs_) {
+    barrier_->count = 0;
+    barrier_->generation++;
+    pthread_cond_broadcast(&barrier_->cond);
+    pthread_mutex_unlock(&barrier_->mutex);
+    return true;
+  }
+  while (barrier_->generation == generation && !barrier_->aborted) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += 100 * 1000 * 1000;
+    if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000 * 1000 * 1000;
+    }
+    if (pthread_cond_timedwait(&barrier_->cond, &barrier_->mutex, &deadline)
+        == EOWNERDEAD) {
+      barrier_->aborted = 1;
+      pthread_mutex_consistent(&barrier_->mutex);
+    }
+    if (k == 0 && barrier_->generation == generation && childFailed()) {
+      barrier_->aborted = 1;
+    }
+    if (barrier_->aborted) {
+      pthread_cond_broadcast(&barrier_->cond);
+    }
+  }
+  bool passed = barrier_->generation != generation;
+  pthread_mutex_unlock(&barrier_->mutex);
+  return passed;
+}
+
+void ProcessTrainer::killChildren() {
+  for (int c=0; c<children_.size(); c++) {
+    if (children_[c] > 0) {
+      kill(children_[c], SIGKILL);
+      waitpid(children_[c], NULL, 0);
+      children_[c] = -1;
+    }
+  }
+}
+
+// copies the parameters of the model to buf or back, buf being laid out as
+// the center, with all the rows of Aw_ or only the flagged ones
+void ProcessTrainer::copyParameters(double* buf, bool toShared,
+                                    bool allRows) {
+  size_t offset = 0;
+  for (int i=0; i<dense_.size(); i++) {
+    size_t n = (size_t) dense_[i]->m_ * dense_[i]->n_;
+    if (toShared) {
+      memcpy(buf + offset, dense_[i]->data_, n * sizeof(double));
+    } else {
+      memcpy(dense_[i]->data_, buf + offset, n * sizeof(double));
+    }
+    offset += n;
+  }
+  int mw = model_.Aw_.n_;
+  for (int r=0; r<model_.Aw_.m_; r++) {
+    if (!allRows && !rowFlags_[r]) {
+      continue;
+    }
+    double* row = model_.Aw_.data_ + (size_t) r * mw;
+    if (toShared) {
+      memcpy(buf + offset + (size_t) r * mw, row, mw * sizeof(double));
+    } else {
+      memcpy(row, buf + offset + (size_t) r * mw, mw * sizeof(double));
+    }
+  }
+}
+
+// averaging of process k, every process calling it after the same number
+// of tokens, false when a process failed
+bool ProcessTrainer::average(int k) {
+  int K = nProcs_;
+  int mw = model_.Aw_.n_;
+  double alpha = elasticAlpha_;
+  if (!barrier(k)) {
+    return false;
+  }
+
+  // publishing the copy, the elastic one being pulled towards the center
+  // before the center moves
+  double* slot = slots_ + k * nParams_;
+  copyParameters(slot, true, false);
+  if (elastic_) {
+    size_t offset = 0;
+    for (int i=0; i<dense_.size(); i++) {
+      size_t n = (size_t) dense_[i]->m_ * dense_[i]->n_;
+      double* x = dense_[i]->data_;
+      for (size_t j=0; j<n; j++) {
+        x[j] -= alpha * (x[j] - center_[offset + j]);
+      }
+      offset += n;
+    }
+    for (int r=0; r<model_.Aw_.m_; r++) {
+      if (rowFlags_[r]) {
+        double* x = model_.Aw_.data_ + (size_t) r * mw;
+        double* c = center_ + offset + (size_t) r * mw;
+        for (int j=0; j<mw; j++) {
+          x[j] -= alpha * (x[j] - c[j]);
+        }
+      }
+    }
+  }
+  if (!barrier(k)) {
+    return false;
+  }
+
+  // each process reduces a range of the dense parameters and every K-th
+  // flagged row, in the order of the processes
+  std::vector<size_t> begins;
+  std::vector<size_t> ends;
+  begins.push_back(nDense_ * k / K);
+  ends.push_back(nDense_ * (k + 1) / K);
+  for (int r=k; r<model_.Aw_.m_; r+=K) {
+    if (rowFlags_[r]) {
+      begins.push_back(nDense_ + (size_t) r * mw);
+      ends.push_back(nDense_ + (size_t) (r + 1) * mw);
+    }
+  }
+  for (int s=0; s<begins.size(); s++) {
+    for (size_t i=begins[s]; i<ends[s]; i++) {
+      double sum = 0.0;
+      for (int p=0; p<K; p++) {
+        sum += slots_[p * nParams_ + i];
+      }
+      if (elastic_) {
+        center_[i] += alpha * (sum - K * center_[i]);
+      } else {
+        center_[i] = sum / K;
+      }
+    }
+  }
+  if (!barrier(k)) {
+    return false;
+  }
+
+  // the averaged rows are the same in every copy again, the elastic ones
+  // stay flagged until the end of the epoch
+  if (elastic_) {
+    return true;
+  }
+  copyParameters(center_, false, false);
+  if (!barrier(k)) {
+    return false;
+  }
+  for (int r=k; r<model_.Aw_.m_; r+=K) {
+    rowFlags_[r] = 0;
+  }
+  return barrier(k);
+}
+
+// process k trains on the tokens [begin, end) in nRounds rounds of at most
+// syncTokens tokens, each followed by an averaging, false when a process
+// failed
+bool ProcessTrainer::worker(int k, DataProvider& dp, size_t begin,
+                            size_t end, int nRounds) {
+  ProcessStats& stats = stats_[k];
+  stats.wordEntropy = 0.0;
+  stats.charEntropy = 0.0;
+  stats.seconds = 0.0;
+  stats.nChars = 0;
+  TokenCursor cursor = dp.getCursor(begin, end);
+  size_t remaining = cursor.size();
+  for (int r=0; r<nRounds; r++) {
+    auto tic = std::chrono::steady_clock::now();
+    size_t n = std::min(remaining, syncTokens_);
+    remaining -= n;
+    while (n > 0) {
+      n -= net_.trainWindow(dp, cursor, n, stats.wordEntropy,
+          stats.charEntropy, stats.nChars);
+      // the words of a completed window are the rows it updated
+      if (net_.getStep() == 0) {
+        for (auto it=model_.updatedWordsList_.begin();
+             it!=model_.updatedWordsList_.end(); ++it) {
+          rowFlags_[*it] = 1;
+        }
+      }
+    }
+    auto toc = std::chrono::steady_clock::now();
+    stats.seconds += std::chrono::duration<double>(toc - tic).count();
+    if (!average(k)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// speed of a single process, a child training alone on the first tokens of
+// [begin, end), its updates being lost with it
+bool ProcessTrainer::measureSerialSpeed(DataProvider& dp, size_t begin,
+                                        size_t end) {
+  size_t nTokens = std::min(end - begin, SERIAL_TOKENS);
+  if (nTokens == 0) {
+    return true;
+  }
+  stats_[0].seconds = 0.0;
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    double wordEntropy = 0.0;
+    double charEntropy = 0.0;
+    int nChars = 0;
+    TokenCursor cursor = dp.getCursor(begin, begin + nTokens);
+    size_t n = nTokens;
+    auto tic = std::chrono::steady_clock::now();
+    while (n > 0) {
+      n -= net_.trainWindow(dp, cursor, n, wordEntropy, charEntropy, nChars);
+    }
+    auto toc = std::chrono::steady_clock::now();
+    stats_[0].seconds = std::chrono::duration<double>(toc - tic).count();
+    _exit(0);
+  }
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  int status = 0;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+      || WEXITSTATUS(status) != 0) {
+    return false;
+  }
+  if (stats_[0].seconds > 0.0) {
+    serialSpeed_ = nTokens / stats_[0].seconds;
+  }
+  return true;
+}
+
+// one pass over the training tokens, false if a process failed; the
+// entropies and the number of chars are summed over the processes
+bool ProcessTrainer::train(DataProvider& dp,
+                           double& seconds,
+                           double& wordEntropy,
+                           double& charEntropy,
+                           int& nChars) {
+  if (shared_ == NULL) {
+    return false;
+  }
+  int K = nProcs_;
+  std::vector<size_t> bounds =
+      ParallelTrainer::getShardBounds(dp.getFileOffsets(), K);
+  if (serialSpeed_ == 0.0 && !measureSerialSpeed(dp, bounds[0], bounds[1])) {
+    return false;
+  }
+  size_t longest = 0;
+  for (int k=0; k<K; k++) {
+    longest = std::max(longest, bounds[k + 1] - bounds[k]);
+  }
+  int nRounds = (longest + syncTokens_ - 1) / syncTokens_;
+  copyParameters(center_, true, true);
+  memset(rowFlags_, 0, model_.Aw_.m_);
+  barrier_->count = 0;
+  barrier_->generation = 0;
+  barrier_->aborted = 0;
+
+  // the children must not print again what is buffered
+  fflush(stdout);
+  fflush(stderr);
+  auto tic = std::chrono::steady_clock::now();
+  children_.clear();
+  for (int k=1; k<K; k++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      // a child does not outlive the calling process
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+      bool ok = worker(k, dp, bounds[k], bounds[k + 1], nRounds);
+      _exit(ok ? 0 : 1);
+    }
+    if (pid < 0) {
+      perror("fork");
+      killChildren();
+      return false;
+    }
+    children_.push_back(pid);
+  }
+  if (!worker(0, dp, bounds[0], bounds[1], nRounds)) {
+    killChildren();
+    return false;
+  }
+  bool ok = true;
+  for (int c=0; c<children_.size(); c++) {
+    int status = 0;
+    if (children_[c] < 0 || waitpid(children_[c], &status, 0) < 0
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      ok = false;
+    }
+    children_[c] = -1;
+  }
+  auto toc = std::chrono::steady_clock::now();
+  double wall = std::chrono::duration<double>(toc - tic).count();
+  seconds = std::chrono::duration_cast<std::chrono::milliseconds>
+      (toc - tic).count() / 1000.0;
+
+  // the model leaves the epoch with the center
+  copyParameters(center_, false, true);
+
+  wordEntropy = 0.0;
+  charEntropy = 0.0;
+  nChars = 0;
+  double busy = 0.0;
+  for (int k=0; k<K; k++) {
+    wordEntropy += stats_[k].wordEntropy;
+    charEntropy += stats_[k].charEntropy;
+    nChars += stats_[k].nChars;
+    busy += stats_[k].seconds;
+  }
+  busyFraction_ = wall > 0.0 ? busy / (K * wall) : 0.0;
+  scalingEfficiency_ = wall > 0.0 && serialSpeed_ > 0.0
+      ? (bounds[K] - bounds[0]) / wall / (K * serialSpeed_) : 0.0;
+  return ok;
+}
+
+// fraction of the process time of the last epoch spent training, the rest
+// going to the averaging and to waiting for the other processes
+double ProcessTrainer::getBusyFraction() {
+  return busyFraction_;
+}
+
+// speed of the last epoch over K times the speed of a single process
+double ProcessTrainer::getScalingEfficiency() {
+  return scalingEfficiency_;
+}
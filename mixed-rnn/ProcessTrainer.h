@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef PROCESSTRAINER_H
+#define PROCESSTRAINER_H
+
+#include "Model.h"
+#include "Rnn.h"
+#include "DataProvider.h"
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Trains a model with several processes, forked for each epoch, each
+// running the BPTT of its copy of the network over a contiguous shard of
+// the training tokens. Every syncTokens tokens the processes meet on a
+// barrier in a shared memory segment and average their parameters:
+//  - model averaging, every copy being replaced by the mean of the copies,
+//  - elastic averaging, every copy and a center variable being pulled
+//    towards each other by alpha times their difference.
+// Only the rows of Aw_ updated by some process are exchanged: with model
+// averaging the ones updated since the last averaging, the others being
+// the same in every copy, with elastic averaging the ones updated since
+// the start of the epoch, as their copies stay apart from the center. The
+// model of the calling process holds the center at the end of an epoch.
+//
+// The calling process is the first trainer and watches the others while
+// it waits on the barrier: when one of them dies the barrier is aborted
+// and the remaining ones are killed.
+class ProcessTrainer {
+  private:
+    struct SharedBarrier {
+      pthread_mutex_t mutex;
+      pthread_cond_t cond;
+      int count;
+      int generation;
+      int aborted;
+    };
+
+    struct ProcessStats {
+      double wordEntropy;
+      double charEntropy;
+      double seconds;
+      int nChars;
+    };
+
+    Model& model_;
+    Rnn& net_;
+    int nProcs_;
+    size_t syncTokens_;
+    bool elastic_;
+    double elasticAlpha_;
+    double busyFraction_;
+    double scalingEfficiency_;
+
+    // words per second of a single process, 0 until measured
+    double serialSpeed_;
+
+    // the dense parameters, then Aw_, flattened in the shared segment
+    std::vector<Matrix*> dense_;
+    size_t nDense_;
+    size_t nParams_;
+
+    // the children of the epoch, -1 once reaped
+    std::vector<pid_t> children_;
+
+    // shared segment: the barrier, the stats of each process, a flag per
+    // row of Aw_, the center and one slot of parameters per process
+    void* shared_;
+    size_t sharedBytes_;
+    SharedBarrier* barrier_;
+    ProcessStats* stats_;
+    unsigned char* rowFlags_;
+    double* center_;
+    double* slots_;
+
+    void lockBarrier();
+    bool childFailed();
+    bool barrier(int);
+    void killChildren();
+    void copyParameters(double*, bool, bool);
+    bool average(int);
+    bool worker(int, DataProvider&, size_t, size_t, int);
+    bool measureSerialSpeed(DataProvider&, size_t, size_t);
+
+  public:
+    ProcessTrainer(Model&, Rnn&, int, size_t, bool, double);
+    ~ProcessTrainer();
+    bool train(DataProvider&, double&, double&, double&, int&);
+    double getBusyFraction();
+    double getScalingEfficiency();
+};
+
+#endif
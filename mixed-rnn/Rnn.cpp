@@ -11,27 +11,31 @@
 #include <math.h>
 #include <iostream>
 #include <float.h>
+#include <algorithm>
 #include <chrono>
 
 extern bool VERBOSE;
 
-Rnn::Rnn(Model& modelRef, std::unordered_map<wchar_t, int>& char2int,
-      std::unordered_map<int, wchar_t>& int2char, int T, double learningRate)
+Rnn::Rnn(Model& modelRef, std::shared_ptr<const Vocabulary> vocab, int T,
+         double learningRate)
     : model_(modelRef),
-      char2int_(char2int),
-      int2char_(int2char),
-      generator_(modelRef, char2int, int2char),
+      vocab_(vocab),
+      generator_(modelRef, vocab->getCharTable()),
       firstWordHidden_(modelRef.mw),
       firstCharHidden_(modelRef.mc),
       lastWordHidden_(modelRef.mw),
       lastCharHidden_(modelRef.mc),
       lastLambda_(modelRef.mw),
-      lastMu_(modelRef.mc) {
+      lastMu_(modelRef.mc),
+      H_(T, modelRef.mw),
+      QH_(T, modelRef.mc) {
   T_ = T;
   lr_ = learningRate;
   lr0_ = lr_;
+  update_ = true;
+  pipeline_ = false;
   for (int t=0; t<T_; t++) {
-    WordModule2 wm(modelRef, char2int, int2char);
+    WordModule2 wm(modelRef, vocab->getCharTable());
     net_.push_back(wm);
   }
   reset();
@@ -45,6 +49,7 @@ void Rnn::reset() {
   lastLambda_.fillValue(0.0);
   lastMu_.fillValue(0.0);
   step_ = 0;
+  computed_ = 0;
 }
 
 void Rnn::updateLearningRate(double shrinkVal) {
@@ -58,6 +63,29 @@ double Rnn::getLr() {
   return lr_;
 }
 
+// whether backward applies the gradients, otherwise they are left in the
+// model for the caller
+void Rnn::setUpdate(bool update) {
+  update_ = update;
+}
+
+// whether forward runs the word and the char levels of the steps of a
+// window on two threads, once the window is loaded, the second thread
+// living as long as the network
+void Rnn::setPipeline(bool pipeline) {
+  pipeline_ = pipeline;
+  pipe_.reset(pipeline ? new ThreadPool(2) : NULL);
+}
+
+// number of words already in the current BPTT window
+int Rnn::getStep() {
+  return step_;
+}
+
+int Rnn::getT() {
+  return T_;
+}
+
 void Rnn::lineSearch() {
   // saving the model
   Model modelSave(model_);
@@ -163,7 +191,9 @@ void Rnn::backward() {
   // printContent();
   // gradientCheck();
   // lineSearch();
-  model_.update(lr_ / T_);
+  if (update_) {
+    model_.update(lr_ / T_);
+  }
 }
 
 void Rnn::computeEntropy(double& wordEntropy, double& charEntropy) {
@@ -188,10 +218,51 @@ void Rnn::printContent() {
   printf("\n");
 }
 
-void Rnn::forward(int w, int wtp1, std::string& stp1, bool train,
+// the word level of the loaded steps only depends on the word hidden before
+// them, it runs ahead: the word hiddens are computed first, their products
+// with Q_ as one GEMM, then the pipe thread runs the char level while this
+// one computes the word outputs
+void Rnn::forwardPending(double& wordEntropy, double& charEntropy) {
+  int begin = computed_;
+  int end = step_;
+  if (!pipeline_ || begin == end) {
+    return;
+  }
+  int mw = model_.mw;
+  for (int t=begin; t<end; t++) {
+    net_[t].forwardHidden(t == 0 ? firstWordHidden_ : net_[t - 1].Ht_);
+    std::copy(net_[t].Ht_.data_, net_[t].Ht_.data_ + mw, H_.data_ + t * mw);
+  }
+  Matrix H;
+  Matrix QH;
+  H.setView(H_, begin, end - begin);
+  QH.setView(QH_, begin, end - begin);
+  QH.matrixMatrix(1.0, H, false, model_.Q_, true, 0.0);
+  for (int t=begin; t<end; t++) {
+    net_[t].QHt_.getRow(QH_, t);
+  }
+
+  pipe_->run(2, 1, [&](int chunk, int /*begin*/, int /*end*/) {
+      for (int t=begin; t<end; t++) {
+        if (chunk == 0) {
+          net_[t].forwardWordOutput(wordEntropy);
+        } else if (t == 0) {
+          net_[0].forwardChars(firstCharHidden_, charEntropy);
+        } else {
+          int Ptm1 = net_[t - 1].lastChar;
+          net_[t].forwardChars(net_[t - 1].hp_[Ptm1 - 1], charEntropy);
+        }
+      }
+  });
+  computed_ = end;
+}
+
+void Rnn::forward(int w, int wtp1, const int* ctp1, int ltp1, bool train,
                   double& wordEntropy, double& charEntropy, int& nChars) {
-  net_[step_].loadData(w, wtp1, stp1);
-  if (step_ == 0) {
+  net_[step_].loadData(w, wtp1, ctp1, ltp1);
+  if (pipeline_) {
+    // forwarded with the rest of the window
+  } else if (step_ == 0) {
     net_[0].forward(firstWordHidden_, firstCharHidden_, wordEntropy, charEntropy);
   } else {
     int Ptm1 = net_[step_ - 1].lastChar;
@@ -201,6 +272,7 @@ void Rnn::forward(int w, int wtp1, std::string& stp1, bool train,
   nChars += net_[step_].lastChar;
   step_++;
   if (step_ == T_) {
+    forwardPending(wordEntropy, charEntropy);
     if (train) {
       backward();
     }
@@ -209,6 +281,7 @@ void Rnn::forward(int w, int wtp1, std::string& stp1, bool train,
     int Ptm1 = net_[step_ - 1].lastChar;
     firstCharHidden_.copy(net_[step_ - 1].hp_[Ptm1 - 1]);
     step_ = 0;
+    computed_ = 0;
   }
 }
 
@@ -226,7 +299,8 @@ void Rnn::train(DataProvider& dp,
   nChars = 0;
   int now = 0;
   int next = 0;
-  std::string nextWord;
+  const int* nextChars = NULL;
+  int nextLength = 0;
   auto tic = std::chrono::steady_clock::now();
   auto toc = std::chrono::steady_clock::now();
   seconds = 0.0;
@@ -251,10 +325,54 @@ void Rnn::train(DataProvider& dp,
         }
       }
     }
-    dp.getToken(now, next, nextWord);
-    forward(now, next, nextWord, doTrain, wordEntropy, charEntropy, nChars);
+    dp.getToken(now, next, nextChars, nextLength);
+    forward(now, next, nextChars, nextLength, doTrain, wordEntropy,
+        charEntropy, nChars);
     loss = model_.alpha_ * wordEntropy + (1.0 - model_.alpha_) * charEntropy;
   }
+  // the steps of an incomplete window
+  forwardPending(wordEntropy, charEntropy);
+}
+
+// trains on one pass over the tokens of a cursor, the entropies and the
+// number of chars are accumulated
+void Rnn::trainShard(DataProvider& dp,
+                     TokenCursor& cursor,
+                     double& wordEntropy,
+                     double& charEntropy,
+                     int& nChars) {
+  int now = 0;
+  int next = 0;
+  const int* nextChars = NULL;
+  int nextLength = 0;
+  for (size_t i=0; i<cursor.size(); i++) {
+    dp.getToken(cursor, now, next, nextChars, nextLength);
+    forward(now, next, nextChars, nextLength, true, wordEntropy,
+        charEntropy, nChars);
+  }
+  forwardPending(wordEntropy, charEntropy);
+}
+
+// trains on the tokens of a cursor until the current window is complete,
+// reading at most nTokens of them, returns the number of tokens read
+size_t Rnn::trainWindow(DataProvider& dp,
+                        TokenCursor& cursor,
+                        size_t nTokens,
+                        double& wordEntropy,
+                        double& charEntropy,
+                        int& nChars) {
+  int now = 0;
+  int next = 0;
+  const int* nextChars = NULL;
+  int nextLength = 0;
+  size_t n = std::min(nTokens, (size_t) (T_ - step_));
+  for (size_t i=0; i<n; i++) {
+    dp.getToken(cursor, now, next, nextChars, nextLength);
+    forward(now, next, nextChars, nextLength, true, wordEntropy,
+        charEntropy, nChars);
+  }
+  forwardPending(wordEntropy, charEntropy);
+  return n;
 }
 
 void Rnn::eval(DataProvider& dp,
@@ -265,10 +383,10 @@ void Rnn::eval(DataProvider& dp,
   train(dp, false, time, wordEntropy, charEntropy, nChars);
 }
 
-void Rnn::generate(DataProvider& dp) {
+void Rnn::generate() {
   int wordId = 0;
   std::string word;
-  dp.randomWord(wordId, word);
+  vocab_->randomWord(wordId, word);
   std::cout << word << " ";
 
   Vector Htm1(firstWordHidden_);
@@ -281,7 +399,7 @@ void Rnn::generate(DataProvider& dp) {
     Htm1.copy(generator_.Ht_);
     htm1P.copy(generator_.hp_[generator_.lastChar - 1]);
 
-    wordId = dp.getWordId(word);
+    wordId = vocab_->getWordId(word);
     if (wordId != 0) {
       std::cout << "#" << word << " ";
     } else {
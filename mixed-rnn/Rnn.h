@@ -11,17 +11,20 @@
 #define RNN_H
 
 #include "Model.h"
+#include "Vocabulary.h"
 #include "Vector.h"
+#include "Matrix.h"
 #include "WordModule.h"
 #include "DataProvider.h"
+#include "ThreadPool.h"
 #include <vector>
 #include <unordered_map>
+#include <memory>
 
 class Rnn {
   private:
     Model& model_;
-    std::unordered_map<wchar_t, int>& char2int_;
-    std::unordered_map<int, wchar_t>& int2char_;
+    std::shared_ptr<const Vocabulary> vocab_;
     std::vector<WordModule2> net_;
     WordModule2 generator_;
     Vector firstWordHidden_;
@@ -35,21 +38,39 @@ class Rnn {
     int step_;
     double lr_;
     double lr0_;
+    bool update_;
+
+    // pipelined forward: the loaded steps from computed_ on are forwarded
+    // together, their word hiddens and products with Q_ being the rows of
+    // H_ and QH_, the word outputs and the char level then running as the
+    // two chunks of pipe_
+    bool pipeline_;
+    std::unique_ptr<ThreadPool> pipe_;
+    int computed_;
+    Matrix H_;
+    Matrix QH_;
+    void forwardPending(double&, double&);
   public:
-    Rnn(Model&, std::unordered_map<wchar_t, int>&,
-        std::unordered_map<int, wchar_t>&, int, double);
+    Rnn(Model&, std::shared_ptr<const Vocabulary>, int, double);
     void reset();
     void updateLearningRate(double);
     double getLr();
+    void setUpdate(bool);
+    void setPipeline(bool);
+    int getStep();
+    int getT();
     void lineSearch();
     void gradientCheck();
     void printContent();
-    void forward(int, int, std::string&, bool, double&, double&, int&);
+    void forward(int, int, const int*, int, bool, double&, double&, int&);
     void backward();
     void computeEntropy(double&, double&);
     void train(DataProvider&, bool, double&, double&, double&, int&);
+    void trainShard(DataProvider&, TokenCursor&, double&, double&, int&);
+    size_t trainWindow(DataProvider&, TokenCursor&, size_t, double&, double&,
+                       int&);
     void eval(DataProvider&, double&, double&, int&);
-    void generate(DataProvider&);
+    void generate();
 };
 
 #endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "ThreadPool.h"
+#include <algorithm>
+
+// multiply-adds of a chunk, enough to pay for its stealing
+static const int CHUNK_WORK = 32768;
+
+// pool of the Vector and Matrix kernels, none when they are single threaded
+static std::unique_ptr<ThreadPool> kernelPool;
+static long long kernelThreshold = 0;
+
+ThreadPool::ThreadPool(int nThreads) {
+  nThreads_ = std::max(nThreads, 1);
+  generation_ = 0;
+  nBusy_ = 0;
+  stop_ = false;
+  body_ = NULL;
+  n_ = 0;
+  grain_ = 1;
+  for (int t=0; t<nThreads_; t++) {
+    queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+    queues_[t]->begin = 0;
+    queues_[t]->end = 0;
+  }
+  for (int t=1; t<nThreads_; t++) {
+    workers_.push_back(std::thread(&ThreadPool::workerLoop, this, t));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (int t=0; t<workers_.size(); t++) {
+    workers_[t].join();
+  }
+}
+
+int ThreadPool::getNumThreads() {
+  return nThreads_;
+}
+
+// next chunk of thread t, the front of its block or the back of another one
+bool ThreadPool::popChunk(int t, int& chunk) {
+  for (int i=0; i<nThreads_; i++) {
+    Queue& q = *queues_[(t + i) % nThreads_];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.begin < q.end) {
+      if (i == 0) {
+        chunk = q.begin++;
+      } else {
+        chunk = --q.end;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::runChunks(int t) {
+  int chunk = 0;
+  while (popChunk(t, chunk)) {
+    int begin = chunk * grain_;
+    (*body_)(chunk, begin, std::min(begin + grain_, n_));
+  }
+}
+
+void ThreadPool::workerLoop(int t) {
+  int seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [this, seen] {
+          return stop_ || generation_ != seen;
+      });
+      if (stop_) {
+        return;
+      }
+      seen = generation_;
+    }
+    runChunks(t);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--nBusy_ == 0) {
+      done_.notify_one();
+    }
+  }
+}
+
+// runs body(chunk, begin, end) on the chunks of grain rows of [0, n), the
+// calling thread taking the first block, and returns when all are done
+void ThreadPool::run(int n, int grain,
+                     const std::function<void(int, int, int)>& body) {
+  int nChunks = (n + grain - 1) / grain;
+  int P = std::min(nThreads_, nChunks);
+  if (P <= 1) {
+    for (int c=0; c<nChunks; c++) {
+      body(c, c * grain, std::min((c + 1) * grain, n));
+    }
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  body_ = &body;
+  n_ = n;
+  grain_ = grain;
+  for (int t=0; t<nThreads_; t++) {
+    queues_[t]->begin = t < P ? (long long) nChunks * t / P : nChunks;
+    queues_[t]->end = t < P ? (long long) nChunks * (t + 1) / P : nChunks;
+  }
+  nBusy_ = nThreads_ - 1;
+  generation_++;
+  lock.unlock();
+  wake_.notify_all();
+
+  runChunks(0);
+  lock.lock();
+  done_.wait(lock, [this] { return nBusy_ == 0; });
+  body_ = NULL;
+}
+
+void ThreadPool::release() {
+  jobMutex_.unlock();
+}
+
+// nThreads threads for the kernels with at least threshold multiply-adds
+void ThreadPool::setKernelPool(int nThreads, long long threshold) {
+  kernelPool.reset(nThreads > 1 ? new ThreadPool(nThreads) : NULL);
+  kernelThreshold = threshold;
+}
+
+// whether the kernels split an operation of the given size in chunks
+bool ThreadPool::isSplit(long long work) {
+  return kernelPool && work >= kernelThreshold;
+}
+
+// the kernel pool, NULL when another thread holds it
+ThreadPool* ThreadPool::acquire() {
+  if (!kernelPool || !kernelPool->jobMutex_.try_lock()) {
+    return NULL;
+  }
+  return kernelPool.get();
+}
+
+// runs the chunks on the pool, or in their order without one
+void ThreadPool::split(ThreadPool* pool, int n, int grain,
+                       const std::function<void(int, int, int)>& body) {
+  if (pool != NULL) {
+    pool->run(n, grain, body);
+    return;
+  }
+  int nChunks = (n + grain - 1) / grain;
+  for (int c=0; c<nChunks; c++) {
+    body(c, c * grain, std::min((c + 1) * grain, n));
+  }
+}
+
+// rows of a chunk for rows of the given length, a multiple of 8 so that the
+// unrolled kernels cut the rows as on a single thread
+int ThreadPool::getChunkRows(int rowLength) {
+  int rows = CHUNK_WORK / std::max(rowLength, 1);
+  return std::max((rows + 7) / 8 * 8, 8);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Persistent threads splitting a single operation, e.g. the product of the
+// word output matrix with the word hidden, by ranges of rows. The rows are
+// cut into chunks of a fixed size dealt in contiguous blocks to the calling
+// thread and the workers, each one taking the chunks of its block from the
+// front and, once done, stealing from the back of the others.
+//
+// The Vector and Matrix kernels split the operations with at least
+// threshold multiply-adds, the small char level products staying whole.
+// The pool runs the chunks of one calling thread at a time, the others
+// running their chunks in order, so that the result of an operation only
+// depends on its size and never on which thread got the pool.
+class ThreadPool {
+  private:
+    struct Queue {
+      std::mutex mutex;
+      int begin;
+      int end;
+    };
+
+    int nThreads_;
+    std::vector<std::thread> workers_;
+    std::vector<std::unique_ptr<Queue>> queues_;
+
+    // a job at a time, held by the kernel from acquire to release
+    std::mutex jobMutex_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    int generation_;
+    int nBusy_;
+    bool stop_;
+
+    // the job: body(chunk, begin, end) for the chunks of grain rows of
+    // [0, n)
+    const std::function<void(int, int, int)>* body_;
+    int n_;
+    int grain_;
+
+    bool popChunk(int, int&);
+    void runChunks(int);
+    void workerLoop(int);
+
+  public:
+    ThreadPool(int);
+    ~ThreadPool();
+    int getNumThreads();
+    void run(int, int, const std::function<void(int, int, int)>&);
+    void release();
+
+    static void setKernelPool(int, long long);
+    static bool isSplit(long long);
+    static ThreadPool* acquire();
+    static void split(ThreadPool*, int, int,
+                      const std::function<void(int, int, int)>&);
+    static int getChunkRows(int);
+};
+
+#endif
@@ -0,0 +1,523 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "TokenArray.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <algorithm>
+
+// number of tokens decoded at once from a packed array or by a cursor
+const size_t TOKEN_BLOCK = 4096;
+
+// whether two files hold the same bytes
+static bool sameFile(const std::string& fname1, const std::string& fname2) {
+  FILE* f1 = fopen(fname1.c_str(), "rb");
+  FILE* f2 = fopen(fname2.c_str(), "rb");
+  bool same = f1 != NULL && f2 != NULL;
+  std::vector<char> buf1(1 << 16);
+  std::vector<char> buf2(1 << 16);
+  while (same) {
+    size_t n1 = fread(buf1.data(), 1, buf1.size(), f1);
+    size_t n2 = fread(buf2.data(), 1, buf2.size(), f2);
+    same = n1 == n2 && memcmp(buf1.data(), buf2.data(), n1) == 0;
+    if (n1 < buf1.size()) {
+      same = same && !ferror(f1) && !ferror(f2);
+      break;
+    }
+  }
+  if (f1 != NULL) {
+    fclose(f1);
+  }
+  if (f2 != NULL) {
+    fclose(f2);
+  }
+  return same;
+}
+
+// moves a complete temporary file to its path, unless the path already
+// holds the same tokens: concurrent runs on a corpus then map one file and
+// share its pages instead of replacing it under each other
+static bool publishFile(const std::string& tmpName, const std::string& fname) {
+  if (link(tmpName.c_str(), fname.c_str()) == 0
+      || sameFile(tmpName, fname)) {
+    remove(tmpName.c_str());
+    return true;
+  }
+  return rename(tmpName.c_str(), fname.c_str()) == 0;
+}
+
+// number of bits of a token id
+static int tokenBits(int32_t token) {
+  int bits = 1;
+  while (bits < 31 && (token >> bits) != 0) {
+    bits++;
+  }
+  return bits;
+}
+
+// writes a token of at most bits bits at bit pos of a packed array
+static void putToken(uint64_t* words, uint64_t pos, int bits, uint64_t v) {
+  int s = pos & 63;
+  words[pos >> 6] |= v << s;
+  if (s + bits > 64) {
+    words[(pos >> 6) + 1] |= v >> (64 - s);
+  }
+}
+
+TokenArray::TokenArray() {
+  size_ = 0;
+  data_ = NULL;
+  begin_ = 0;
+  length_ = 0;
+  map_ = NULL;
+  mapLength_ = 0;
+  chunkSize_ = 0;
+  spool_ = NULL;
+  fd_ = -1;
+  fileOffset_ = 0;
+  nextBegin_ = 0;
+  bits_ = 0;
+}
+
+TokenArray::~TokenArray() {
+  clear();
+}
+
+void TokenArray::unmap() {
+  if (map_ != NULL) {
+    munmap(map_, mapLength_);
+    map_ = NULL;
+    mapLength_ = 0;
+  }
+}
+
+// waits for the prefetch in flight and closes the files of a streamed array
+void TokenArray::closeStream() {
+  if (prefetch_.valid()) {
+    prefetch_.wait();
+    prefetch_ = std::future<bool>();
+  }
+  std::vector<int32_t>().swap(nextChunk_);
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  if (spool_ != NULL) {
+    fclose(spool_);
+    spool_ = NULL;
+    remove((spoolName_ + ".tmp" + std::to_string(getpid())).c_str());
+  }
+}
+
+// number of tokens per chunk of a streamed array, 0 to keep all of them in
+// memory, applies to the next spool or mapped file
+void TokenArray::setChunkSize(size_t chunkSize) {
+  chunkSize_ = chunkSize;
+}
+
+// starts spooling the tokens of a streamed array to a file
+bool TokenArray::openSpool(std::string fname) {
+  assert(chunkSize_ > 0);
+  clear();
+  spoolName_ = fname;
+  std::string tmpName = fname + ".tmp" + std::to_string(getpid());
+  spool_ = fopen(tmpName.c_str(), "wb");
+  return spool_ != NULL;
+}
+
+// writes the last tokens to the spool and opens it for streaming
+bool TokenArray::closeSpool() {
+  if (spool_ == NULL) {
+    return true;
+  }
+  std::string tmpName = spoolName_ + ".tmp" + std::to_string(getpid());
+  bool ok = fwrite(storage_.data(), sizeof(int32_t), storage_.size(), spool_)
+      == storage_.size();
+  ok = !ferror(spool_) && ok;
+  ok = (fclose(spool_) == 0) && ok;
+  spool_ = NULL;
+  if (ok) {
+    ok = publishFile(tmpName, spoolName_);
+  }
+  if (!ok) {
+    remove(tmpName.c_str());
+    clear();
+    return false;
+  }
+  return mapFile(spoolName_, 0, size_);
+}
+
+void TokenArray::push_back(int token) {
+  assert(map_ == NULL && fd_ < 0);
+  if (bits_ > 0) {
+    pushPacked(token);
+    return;
+  }
+  storage_.push_back(token);
+  size_++;
+  if (spool_ != NULL) {
+    if (storage_.size() == chunkSize_) {
+      fwrite(storage_.data(), sizeof(int32_t), chunkSize_, spool_);
+      storage_.clear();
+    }
+    return;
+  }
+  data_ = storage_.data();
+  length_ = size_;
+}
+
+// takes the tokens of a vector, leaving it with the previous tokens
+void TokenArray::swap(std::vector<int32_t>& tokens) {
+  assert(map_ == NULL && fd_ < 0 && spool_ == NULL && bits_ == 0);
+  storage_.swap(tokens);
+  data_ = storage_.data();
+  size_ = storage_.size();
+  length_ = size_;
+}
+
+// reserves room for n tokens on the heap, only before packing
+void TokenArray::reserve(size_t n) {
+  if (bits_ == 0 && spool_ == NULL) {
+    storage_.reserve(n);
+    data_ = storage_.data();
+  }
+}
+
+void TokenArray::clear() {
+  unmap();
+  closeStream();
+  std::vector<int32_t>().swap(storage_);
+  std::vector<uint64_t>().swap(packed_);
+  bits_ = 0;
+  size_ = 0;
+  data_ = NULL;
+  begin_ = 0;
+  length_ = 0;
+}
+
+// replaces the tokens held in memory or mapped by their bit-packed copy on
+// the heap, returns the number of bits per token, 0 for a streamed array,
+// the tokens pushed afterwards are packed one by one so that an array packed
+// while empty never holds their unpacked copy
+int TokenArray::pack() {
+  if (bits_ > 0 || spool_ != NULL || fd_ >= 0) {
+    return bits_;
+  }
+  int32_t maxToken = 0;
+  for (size_t i=0; i<size_; i++) {
+    assert(data_[i] >= 0);
+    maxToken = std::max(maxToken, data_[i]);
+  }
+  int bits = tokenBits(maxToken);
+
+  // one word of padding so that a token is always read from two words
+  std::vector<uint64_t> packed((size_ * bits + 63) / 64 + 1, 0);
+  for (size_t i=0; i<size_; i++) {
+    putToken(packed.data(), i * bits, bits, data_[i]);
+  }
+
+  size_t n = size_;
+  clear();
+  packed_.swap(packed);
+  bits_ = bits;
+  size_ = n;
+  return bits_;
+}
+
+// appends a token to a packed array, repacked with more bits when the token
+// does not fit: the width doubles the range of the ids each time, so a
+// corpus is repacked at most a few times, early while it is small
+void TokenArray::pushPacked(int32_t token) {
+  assert(token >= 0);
+  if ((token >> bits_) != 0) {
+    widen(tokenBits(token));
+  }
+  uint64_t pos = size_ * bits_;
+  packed_.resize((pos + bits_ + 63) / 64 + 1, 0);
+  putToken(packed_.data(), pos, bits_, token);
+  size_++;
+}
+
+// repacks the tokens of a packed array with bits bits per token
+void TokenArray::widen(int bits) {
+  std::vector<uint64_t> packed((size_ * bits + 63) / 64 + 1, 0);
+  std::vector<int32_t> block(TOKEN_BLOCK);
+  for (size_t i=0; i<size_; i+=TOKEN_BLOCK) {
+    size_t n = std::min(TOKEN_BLOCK, size_ - i);
+    unpack(i, n, block.data());
+    for (size_t k=0; k<n; k++) {
+      putToken(packed.data(), (i + k) * bits, bits, block[k]);
+    }
+  }
+  packed_.swap(packed);
+  bits_ = bits;
+}
+
+// number of bits per token of a packed array, 0 when it is not packed
+int TokenArray::getBits() {
+  return bits_;
+}
+
+size_t TokenArray::size() {
+  return size_;
+}
+
+int TokenArray::get(size_t i) {
+  size_t j = i - begin_;
+  if (j < length_) {
+    return data_[j];
+  }
+  if (bits_ > 0) {
+    return loadBlock(i);
+  }
+  return loadChunk(i);
+}
+
+// decodes the tokens [begin, begin + n) of a packed array
+void TokenArray::unpack(size_t begin, size_t n, int32_t* out) {
+  uint64_t mask = (1ULL << bits_) - 1;
+  uint64_t pos = begin * bits_;
+  for (size_t k=0; k<n; k++, pos += bits_) {
+    const uint64_t* w = packed_.data() + (pos >> 6);
+    int s = pos & 63;
+    // the high word is shifted in two steps, s can be 0
+    uint64_t v = (w[0] >> s) | ((w[1] << 1) << (63 - s));
+    out[k] = v & mask;
+  }
+}
+
+// decodes the block of token i of a packed array into storage_
+int TokenArray::loadBlock(size_t i) {
+  assert(i < size_ && bits_ > 0);
+  size_t begin = i / TOKEN_BLOCK * TOKEN_BLOCK;
+  size_t n = std::min(TOKEN_BLOCK, size_ - begin);
+  storage_.resize(n);
+  unpack(begin, n, storage_.data());
+  data_ = storage_.data();
+  begin_ = begin;
+  length_ = n;
+  return data_[i - begin];
+}
+
+// copies the tokens [begin, begin + n) to out, leaving the current chunk or
+// block alone so that several threads can read the array at once
+void TokenArray::read(size_t begin, size_t n, int32_t* out) {
+  assert(begin + n <= size_ && spool_ == NULL);
+  if (bits_ > 0) {
+    unpack(begin, n, out);
+  } else if (fd_ >= 0) {
+    if (!readRaw(begin, n, out)) {
+      fprintf(stderr, "Could not read the tokens from %zu\n", begin);
+      exit(1);
+    }
+  } else {
+    assert(begin_ == 0 && length_ == size_);
+    memcpy(out, data_ + begin, n * sizeof(int32_t));
+  }
+}
+
+// reads n raw tokens from the file of a streamed array, pread leaves the
+// file offset alone so this may run on any thread
+bool TokenArray::readRaw(size_t begin, size_t n, int32_t* out) {
+  char* buf = (char*) out;
+  size_t length = n * sizeof(int32_t);
+  int64_t offset = fileOffset_ + begin * sizeof(int32_t);
+  while (length > 0) {
+    ssize_t r = pread(fd_, buf, length, offset);
+    if (r <= 0) {
+      return false;
+    }
+    buf += r;
+    length -= r;
+    offset += r;
+  }
+  return true;
+}
+
+// reads the chunk c of a streamed array, may run on the prefetch thread
+bool TokenArray::readChunk(size_t c, std::vector<int32_t>& chunk) {
+  size_t begin = c * chunkSize_;
+  size_t n = std::min(chunkSize_, size_ - begin);
+  chunk.resize(n);
+  return readRaw(begin, n, chunk.data());
+}
+
+void TokenArray::startPrefetch(size_t c) {
+  nextBegin_ = c * chunkSize_;
+  prefetch_ = std::async(std::launch::async, &TokenArray::readChunk, this,
+      c, std::ref(nextChunk_));
+}
+
+// makes the chunk of token i current, taking it from the prefetch when it
+// was the one expected, and prefetches the chunk following it
+int TokenArray::loadChunk(size_t i) {
+  assert(i < size_ && fd_ >= 0);
+  size_t c = i / chunkSize_;
+  bool ok = false;
+  if (prefetch_.valid()) {
+    ok = prefetch_.get();
+    if (ok && nextBegin_ == c * chunkSize_) {
+      storage_.swap(nextChunk_);
+    } else {
+      ok = false;
+    }
+  }
+  if (!ok && !readChunk(c, storage_)) {
+    fprintf(stderr, "Could not read the tokens of chunk %zu\n", c);
+    exit(1);
+  }
+  data_ = storage_.data();
+  begin_ = c * chunkSize_;
+  length_ = storage_.size();
+
+  size_t nChunks = (size_ + chunkSize_ - 1) / chunkSize_;
+  if (nChunks > 1) {
+    startPrefetch((c + 1) % nChunks);
+  }
+  return data_[i - begin_];
+}
+
+// writes the raw tokens at the current position of a file
+bool TokenArray::write(FILE* f) {
+  assert(spool_ == NULL);
+  if (bits_ > 0) {
+    for (size_t i=0; i<size_; i+=TOKEN_BLOCK) {
+      loadBlock(i);
+      if (fwrite(data_, sizeof(int32_t), length_, f) != length_) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (fd_ < 0) {
+    return fwrite(data_, sizeof(int32_t), size_, f) == size_;
+  }
+  std::vector<int32_t> chunk;
+  size_t nChunks = (size_ + chunkSize_ - 1) / chunkSize_;
+  for (size_t c=0; c<nChunks; c++) {
+    if (!readChunk(c, chunk) ||
+        fwrite(chunk.data(), sizeof(int32_t), chunk.size(), f)
+        != chunk.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// writes the raw tokens, through a temporary file published at the end so
+// that concurrent writers of the same path never expose a partial file
+bool TokenArray::writeFile(std::string fname) {
+  std::string tmpName = fname + ".tmp" + std::to_string(getpid());
+  FILE* f = fopen(tmpName.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+  bool ok = write(f);
+  ok = (fclose(f) == 0) && ok;
+  if (ok) {
+    ok = publishFile(tmpName, fname);
+  }
+  if (!ok) {
+    remove(tmpName.c_str());
+  }
+  return ok;
+}
+
+// replaces the tokens by a read-only shared mapping of a file of raw tokens
+bool TokenArray::mapFile(std::string fname) {
+  struct stat st;
+  if (stat(fname.c_str(), &st) != 0 || st.st_size % sizeof(int32_t) != 0) {
+    return false;
+  }
+  return mapFile(fname, 0, st.st_size / sizeof(int32_t));
+}
+
+// maps n tokens stored at a page aligned offset of a file, a streamed array
+// reads them by chunks instead
+bool TokenArray::mapFile(std::string fname, int64_t offset, size_t n) {
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  size_t length = n * sizeof(int32_t);
+  if (fstat(fd, &st) != 0 || st.st_size < offset + (int64_t) length) {
+    close(fd);
+    return false;
+  }
+  if (chunkSize_ > 0) {
+    clear();
+    fd_ = fd;
+    fileOffset_ = offset;
+    size_ = n;
+    return true;
+  }
+  void* map = NULL;
+  if (length > 0) {
+    map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, offset);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  clear();
+  map_ = map;
+  mapLength_ = length;
+  data_ = (const int32_t*) map;
+  size_ = n;
+  length_ = n;
+  return true;
+}
+
+// moves the tokens from the heap to a memory mapped file
+bool TokenArray::moveToFile(std::string fname) {
+  return writeFile(fname) && mapFile(fname);
+}
+
+TokenCursor::TokenCursor(TokenArray& tokens, size_t begin, size_t end) {
+  assert(begin <= end && end <= tokens.size());
+  tokens_ = &tokens;
+  begin_ = begin;
+  end_ = end;
+  pos_ = begin;
+  blockBegin_ = 0;
+}
+
+size_t TokenCursor::size() {
+  return end_ - begin_;
+}
+
+int TokenCursor::get(size_t i) {
+  size_t j = i - blockBegin_;
+  if (j < block_.size()) {
+    return block_[j];
+  }
+  size_t n = std::min(TOKEN_BLOCK, tokens_->size() - i);
+  block_.resize(n);
+  tokens_->read(i, n, block_.data());
+  blockBegin_ = i;
+  return block_[0];
+}
+
+// gives the current token and the one following it in the array, the first
+// one after the last, then moves on, back to begin after end
+void TokenCursor::next(int& now, int& following) {
+  now = get(pos_);
+  pos_++;
+  following = get(pos_ < tokens_->size() ? pos_ : 0);
+  if (pos_ == end_) {
+    pos_ = begin_;
+  }
+}
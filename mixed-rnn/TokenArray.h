@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef TOKENARRAY_H
+#define TOKENARRAY_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <future>
+
+// Flat array of token ids, held on the heap while the corpus is read and
+// optionally moved to a read-only memory mapped file afterwards, so that
+// processes reading the same corpus share its pages.
+//
+// A streamed array (positive chunk size) never holds more than two chunks:
+// the tokens are spooled to a file while the corpus is read, then read back
+// one chunk at a time, the following chunk (the first one after the last)
+// being prefetched by a background thread. Random access works but only
+// sequential access is cheap.
+//
+// An array in memory can also be bit-packed, each token taking as many bits
+// as the largest one needs, either once read or as the tokens are pushed. It
+// is then decoded one block at a time, with the same cost model as a
+// streamed array. The blocks are decoded when they are read and not ahead:
+// with 17 bits a cursor reads a token in 12 ns instead of 9, against tens of
+// microseconds to train on it.
+class TokenArray {
+  private:
+    std::vector<int32_t> storage_;
+    size_t size_;
+
+    // tokens [begin_, begin_ + length_) are at data_
+    const int32_t* data_;
+    size_t begin_;
+    size_t length_;
+
+    // memory mapping, NULL when the tokens are on the heap
+    void* map_;
+    size_t mapLength_;
+
+    // streaming, chunkSize_ is 0 when the tokens are all in memory
+    size_t chunkSize_;
+    FILE* spool_;
+    std::string spoolName_;
+    int fd_;
+    int64_t fileOffset_;
+    std::vector<int32_t> nextChunk_;
+    size_t nextBegin_;
+    std::future<bool> prefetch_;
+
+    // packing, bits_ is 0 when the tokens are not packed
+    std::vector<uint64_t> packed_;
+    int bits_;
+
+    void unmap();
+    void closeStream();
+    bool readRaw(size_t, size_t, int32_t*);
+    bool readChunk(size_t, std::vector<int32_t>&);
+    void startPrefetch(size_t);
+    int loadChunk(size_t);
+    void unpack(size_t, size_t, int32_t*);
+    int loadBlock(size_t);
+    void pushPacked(int32_t);
+    void widen(int);
+
+  public:
+    TokenArray();
+    ~TokenArray();
+    // the mapping and the files are owned by a single array
+    TokenArray(const TokenArray&) = delete;
+    TokenArray& operator=(const TokenArray&) = delete;
+    void setChunkSize(size_t);
+    bool openSpool(std::string);
+    bool closeSpool();
+    void push_back(int);
+    void swap(std::vector<int32_t>&);
+    void reserve(size_t);
+    void clear();
+    int pack();
+    int getBits();
+    size_t size();
+    int get(size_t);
+    void read(size_t, size_t, int32_t*);
+    bool write(FILE*);
+    bool writeFile(std::string);
+    bool mapFile(std::string);
+    bool mapFile(std::string, int64_t, size_t);
+    bool moveToFile(std::string);
+};
+
+// Reads the tokens [begin, end) of an array by blocks copied to its own
+// buffer, so that several cursors read the same array from different
+// threads. The array must not be modified meanwhile.
+class TokenCursor {
+  private:
+    TokenArray* tokens_;
+    size_t begin_;
+    size_t end_;
+    size_t pos_;
+    std::vector<int32_t> block_;
+    size_t blockBegin_;
+
+    int get(size_t);
+
+  public:
+    TokenCursor(TokenArray&, size_t, size_t);
+    size_t size();
+    void next(int&, int&);
+};
+
+#endif
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "Utf8.h"
+#include <string.h>
+#include <wchar.h>
+#include <algorithm>
+#if defined(__SSE2__) && WCHAR_MAX > 0xffff
+#include <emmintrin.h>
+#define UTF8_SSE2
+#endif
+
+const size_t UTF8_BLOCK_SIZE = 1 << 20;
+
+// writes the UTF-8 bytes of a code point, returns their number
+int encodeUtf8(wchar_t wc, char* mbs) {
+  unsigned int c = wc;
+  if (c < 0x80) {
+    mbs[0] = c;
+    return 1;
+  }
+  if (c < 0x800) {
+    mbs[0] = 0xc0 | (c >> 6);
+    mbs[1] = 0x80 | (c & 0x3f);
+    return 2;
+  }
+  if (c > 0x10ffff || (c >= 0xd800 && c < 0xe000)) {
+    c = REPLACEMENT_CHAR;
+  }
+  if (c < 0x10000) {
+    mbs[0] = 0xe0 | (c >> 12);
+    mbs[1] = 0x80 | ((c >> 6) & 0x3f);
+    mbs[2] = 0x80 | (c & 0x3f);
+    return 3;
+  }
+  mbs[0] = 0xf0 | (c >> 18);
+  mbs[1] = 0x80 | ((c >> 12) & 0x3f);
+  mbs[2] = 0x80 | ((c >> 6) & 0x3f);
+  mbs[3] = 0x80 | (c & 0x3f);
+  return 4;
+}
+
+Utf8Reader::Utf8Reader(std::string fname) {
+  f_ = fopen(fname.c_str(), "rb");
+  buf_.resize(UTF8_BLOCK_SIZE);
+  pending_ = 0;
+  nBytes_ = 0;
+}
+
+Utf8Reader::~Utf8Reader() {
+  if (f_ != NULL) {
+    fclose(f_);
+  }
+}
+
+bool Utf8Reader::good() {
+  return f_ != NULL;
+}
+
+// number of bytes read so far
+size_t Utf8Reader::getNumBytes() {
+  return nBytes_;
+}
+
+static bool isContinuation(unsigned char b) {
+  return (b & 0xc0) == 0x80;
+}
+
+// decodes the bytes [0, n) to out, a sequence cut by the end of the bytes
+// is left undecoded unless atEnd, returns the number of bytes decoded
+static size_t decode(const unsigned char* p, size_t n, bool atEnd,
+                     wchar_t* out, size_t& nChars) {
+  wchar_t* begin = out;
+  size_t i = 0;
+  while (i < n) {
+#ifdef UTF8_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= n) {
+      __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+      if (_mm_movemask_epi8(v) != 0) {
+        break;
+      }
+      __m128i lo = _mm_unpacklo_epi8(v, zero);
+      __m128i hi = _mm_unpackhi_epi8(v, zero);
+      _mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi16(lo, zero));
+      _mm_storeu_si128((__m128i*) (out + 4), _mm_unpackhi_epi16(lo, zero));
+      _mm_storeu_si128((__m128i*) (out + 8), _mm_unpacklo_epi16(hi, zero));
+      _mm_storeu_si128((__m128i*) (out + 12), _mm_unpackhi_epi16(hi, zero));
+      out += 16;
+      i += 16;
+    }
+    if (i == n) {
+      break;
+    }
+#endif
+    unsigned char b = p[i];
+    if (b < 0x80) {
+      *out++ = b;
+      i++;
+      continue;
+    }
+
+    int length = 0;
+    unsigned int c = 0;
+    unsigned int min = 0;
+    if (b >= 0xc2 && b <= 0xdf) {
+      length = 2;
+      c = b & 0x1f;
+      min = 0x80;
+    } else if (b >= 0xe0 && b <= 0xef) {
+      length = 3;
+      c = b & 0x0f;
+      min = 0x800;
+    } else if (b >= 0xf0 && b <= 0xf4) {
+      length = 4;
+      c = b & 0x07;
+      min = 0x10000;
+    }
+    if (length > 0 && i + length > n && !atEnd) {
+      break;
+    }
+    bool valid = length > 0 && i + length <= n;
+    for (int j=1; j<length && valid; j++) {
+      valid = isContinuation(p[i + j]);
+      c = (c << 6) | (p[i + j] & 0x3f);
+    }
+    valid = valid && c >= min && c <= 0x10ffff && (c < 0xd800 || c >= 0xe000);
+    if (valid) {
+      *out++ = c;
+      i += length;
+    } else {
+      *out++ = REPLACEMENT_CHAR;
+      i++;
+    }
+  }
+  nChars = out - begin;
+  return i;
+}
+
+// decodes a string to at most n - 1 code points followed by a 0, as
+// mbstowcs does, returns the number of code points
+size_t decodeUtf8(const std::string& str, wchar_t* wcs, size_t n) {
+  std::vector<wchar_t> chars(str.size());
+  size_t nChars = 0;
+  decode((const unsigned char*) str.data(), str.size(), true, chars.data(),
+      nChars);
+  nChars = std::min(nChars, n - 1);
+  memcpy(wcs, chars.data(), nChars * sizeof(wchar_t));
+  wcs[nChars] = 0;
+  return nChars;
+}
+
+// decodes the next block of the file into chars, a sequence cut by the end
+// of the block is kept for the next one, returns 0 at the end of the file
+size_t Utf8Reader::read(std::vector<wchar_t>& chars) {
+  chars.clear();
+  if (f_ == NULL) {
+    return 0;
+  }
+  size_t nRead = fread(buf_.data() + pending_, 1, buf_.size() - pending_, f_);
+  bool atEnd = nRead < buf_.size() - pending_;
+  size_t n = pending_ + nRead;
+  nBytes_ += nRead;
+
+  chars.resize(n);
+  size_t nChars = 0;
+  size_t nDecoded = decode(buf_.data(), n, atEnd, chars.data(), nChars);
+  pending_ = n - nDecoded;
+  memmove(buf_.data(), buf_.data() + nDecoded, pending_);
+  chars.resize(nChars);
+  return nChars;
+}
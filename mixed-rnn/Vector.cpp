@@ -9,12 +9,21 @@
 
 #include "Vector.h"
 #include "Matrix.h"
+#include "ThreadPool.h"
 #include <math.h>
 #include <cblas.h>
 #include <float.h>
+#include <algorithm>
+#include <vector>
 
 extern bool USE_BLAS;
 
+// cost of an exp in multiply-adds, for the size of a softmax
+static const int EXP_WORK = 16;
+
+// partial results of the chunks of a split operation
+static thread_local std::vector<double> partials;
+
 Vector::Vector(int m) {
   m_ = m;
   data_ = new double[m];
@@ -142,6 +151,14 @@ void Vector::aTimesOneMinusA() {
 }
 
 void Vector::softMax() {
+  if (ThreadPool::isSplit((long long) m_ * EXP_WORK)) {
+    ThreadPool* pool = ThreadPool::acquire();
+    softMax(pool);
+    if (pool != NULL) {
+      pool->release();
+    }
+    return;
+  }
   double sum = 0.0;
   double M = max();
   for (int i=0; i<m_; i++) {
@@ -153,6 +170,48 @@ void Vector::softMax() {
   }
 }
 
+// softmax by chunks, on the pool if any, the max and the sum being reduced
+// over the chunks in their order
+void Vector::softMax(ThreadPool* pool) {
+  int grain = ThreadPool::getChunkRows(EXP_WORK);
+  int nChunks = (m_ + grain - 1) / grain;
+  partials.resize(nChunks);
+  double* partial = partials.data();
+  ThreadPool::split(pool, m_, grain,
+      [this, partial](int c, int begin, int end) {
+      double M = -DBL_MAX;
+      for (int i=begin; i<end; i++) {
+        if (data_[i] > M) {
+          M = data_[i];
+        }
+      }
+      partial[c] = M;
+  });
+  double M = -DBL_MAX;
+  for (int c=0; c<nChunks; c++) {
+    M = std::max(M, partial[c]);
+  }
+  ThreadPool::split(pool, m_, grain,
+      [this, partial, M](int c, int begin, int end) {
+      double sum = 0.0;
+      for (int i=begin; i<end; i++) {
+        data_[i] = exp(data_[i] - M);
+        sum += data_[i];
+      }
+      partial[c] = sum;
+  });
+  double sum = 0.0;
+  for (int c=0; c<nChunks; c++) {
+    sum += partial[c];
+  }
+  ThreadPool::split(pool, m_, grain,
+      [this, sum](int /*chunk*/, int begin, int end) {
+      for (int i=begin; i<end; i++) {
+        data_[i] /= sum;
+      }
+  });
+}
+
 // vector becomes the j-th column of matrix A
 void Vector::getColumn(Matrix& A, int j) {
   assert(m_ == A.m_);
@@ -188,31 +247,34 @@ void Vector::timesVectors(Vector& a, Vector& b) {
   }
 }
 
-// computes the GEMV this = a * matB * vecC + d * this
-void Vector::matrixVector(double a, Matrix& matB, Vector& vecC, double d) {
-  assert(m_ == matB.m_);
-  assert(matB.n_ == vecC.m_);
+// GEMV y = a * B * c + d * y of the m rows of B of length n
+static void matrixVectorRows(double a, double* B, int m, int n, double* c,
+                             double d, double* y) {
   if (USE_BLAS) {
-    cblas_dgemv(CblasRowMajor, CblasNoTrans, matB.m_, matB.n_, a, matB.data_,
-        matB.n_, vecC.data_, 1, d, data_, 1);
+    cblas_dgemv(CblasRowMajor, CblasNoTrans, m, n, a, B, n, c, 1, d, y, 1);
   } else {
     int i = 0;
-    int m = m_;
-    int n = vecC.m_;
-
-    for (i=0; i < m/8; i++) {
-      data_[i * 8 + 0] *= d;
-      data_[i * 8 + 1] *= d;
-      data_[i * 8 + 2] *= d;
-      data_[i * 8 + 3] *= d;
-
-      data_[i * 8 + 4] *= d;
-      data_[i * 8 + 5] *= d;
-      data_[i * 8 + 6] *= d;
-      data_[i * 8 + 7] *= d;
-    }
-    for (int ip = i*8; ip<m; ip++) {
-      data_[ip] *= d;
+
+    // as in BLAS this is not read when d is 0, it may be uninitialized
+    if (d == 0.0) {
+      for (i=0; i<m; i++) {
+        y[i] = 0.0;
+      }
+    } else {
+      for (i=0; i < m/8; i++) {
+        y[i * 8 + 0] *= d;
+        y[i * 8 + 1] *= d;
+        y[i * 8 + 2] *= d;
+        y[i * 8 + 3] *= d;
+
+        y[i * 8 + 4] *= d;
+        y[i * 8 + 5] *= d;
+        y[i * 8 + 6] *= d;
+        y[i * 8 + 7] *= d;
+      }
+      for (int ip = i*8; ip<m; ip++) {
+        y[ip] *= d;
+      }
     }
 
     double val0 = 0.0;
@@ -236,57 +298,109 @@ void Vector::matrixVector(double a, Matrix& matB, Vector& vecC, double d) {
       val6 = 0.0;
       val7 = 0.0;
       for (int j=0; j<n; j++) {
-        val0 += matB.data_[(i * 8 + 0) * n + j] * vecC.data_[j];
-        val1 += matB.data_[(i * 8 + 1) * n + j] * vecC.data_[j];
-        val2 += matB.data_[(i * 8 + 2) * n + j] * vecC.data_[j];
-        val3 += matB.data_[(i * 8 + 3) * n + j] * vecC.data_[j];
-
-        val4 += matB.data_[(i * 8 + 4) * n + j] * vecC.data_[j];
-        val5 += matB.data_[(i * 8 + 5) * n + j] * vecC.data_[j];
-        val6 += matB.data_[(i * 8 + 6) * n + j] * vecC.data_[j];
-        val7 += matB.data_[(i * 8 + 7) * n + j] * vecC.data_[j];
+        val0 += B[(i * 8 + 0) * n + j] * c[j];
+        val1 += B[(i * 8 + 1) * n + j] * c[j];
+        val2 += B[(i * 8 + 2) * n + j] * c[j];
+        val3 += B[(i * 8 + 3) * n + j] * c[j];
+
+        val4 += B[(i * 8 + 4) * n + j] * c[j];
+        val5 += B[(i * 8 + 5) * n + j] * c[j];
+        val6 += B[(i * 8 + 6) * n + j] * c[j];
+        val7 += B[(i * 8 + 7) * n + j] * c[j];
       }
-      data_[i * 8 + 0] += val0;
-      data_[i * 8 + 1] += val1;
-      data_[i * 8 + 2] += val2;
-      data_[i * 8 + 3] += val3;
-
-      data_[i * 8 + 4] += val4;
-      data_[i * 8 + 5] += val5;
-      data_[i * 8 + 6] += val6;
-      data_[i * 8 + 7] += val7;
+      y[i * 8 + 0] += val0;
+      y[i * 8 + 1] += val1;
+      y[i * 8 + 2] += val2;
+      y[i * 8 + 3] += val3;
+
+      y[i * 8 + 4] += val4;
+      y[i * 8 + 5] += val5;
+      y[i * 8 + 6] += val6;
+      y[i * 8 + 7] += val7;
     }
     for (int ip=i*8; ip < m; ip++) {
       for (int j = 0; j<n; j++) {
-        data_[ip] += matB.data_[ip * n + j] * vecC.data_[j];
+        y[ip] += B[ip * n + j] * c[j];
       }
     }
   }
 }
 
-// computes the GEMV this = a * matB^T * vecC + d * this
-void Vector::matrixTVector(double a, Matrix& matB, Vector& vecC, double d) {
-  assert(m_ == matB.n_);
-  assert(matB.m_ == vecC.m_);
+// computes the GEMV this = a * matB * vecC + d * this
+void Vector::matrixVector(double a, Matrix& matB, Vector& vecC, double d) {
+  assert(m_ == matB.m_);
+  assert(matB.n_ == vecC.m_);
+  int n = matB.n_;
+  if (!ThreadPool::isSplit((long long) m_ * n)) {
+    matrixVectorRows(a, matB.data_, m_, n, vecC.data_, d, data_);
+    return;
+  }
+  // the rows of the output are independent
+  ThreadPool* pool = ThreadPool::acquire();
+  ThreadPool::split(pool, m_, ThreadPool::getChunkRows(n),
+      [this, a, &matB, &vecC, d, n](int /*chunk*/, int begin, int end) {
+      matrixVectorRows(a, matB.data_ + (size_t) begin * n, end - begin, n,
+          vecC.data_, d, data_ + begin);
+  });
+  if (pool != NULL) {
+    pool->release();
+  }
+}
+
+// GEMV y = a * B^T * c + d * y of the m rows of B of length n
+static void matrixTVectorRows(double a, double* B, int m, int n, double* c,
+                              double d, double* y) {
   if (USE_BLAS) {
-    cblas_dgemv(CblasRowMajor, CblasTrans, matB.m_, matB.n_, a, matB.data_,
-        matB.n_, vecC.data_, 1, d, data_, 1);
+    cblas_dgemv(CblasRowMajor, CblasTrans, m, n, a, B, n, c, 1, d, y, 1);
   } else {
     double mult = 0.0;
-    int m = matB.m_;
-    int n = matB.n_;
     for (int j=0; j<n; j++) {
-      data_[j] *= d;
+      y[j] = (d == 0.0) ? 0.0 : d * y[j];
     }
     for (int i=0; i<m; i++) {
-      mult = vecC.data_[i];
+      mult = c[i];
       for (int j=0; j<n; j++) {
-        data_[j] += mult * matB.data_[i * n + j];
+        y[j] += mult * B[i * n + j];
       }
     }
   }
 }
 
+// computes the GEMV this = a * matB^T * vecC + d * this
+void Vector::matrixTVector(double a, Matrix& matB, Vector& vecC, double d) {
+  assert(m_ == matB.n_);
+  assert(matB.m_ == vecC.m_);
+  int m = matB.m_;
+  int n = matB.n_;
+  if (!ThreadPool::isSplit((long long) m * n)) {
+    matrixTVectorRows(a, matB.data_, m, n, vecC.data_, d, data_);
+    return;
+  }
+  // every chunk of rows of matB gives a partial output, summed in the order
+  // of the chunks
+  int grain = ThreadPool::getChunkRows(n);
+  int nChunks = (m + grain - 1) / grain;
+  partials.resize((size_t) nChunks * n);
+  double* partial = partials.data();
+  ThreadPool* pool = ThreadPool::acquire();
+  ThreadPool::split(pool, m, grain,
+      [a, &matB, &vecC, n, partial](int c, int begin, int end) {
+      matrixTVectorRows(a, matB.data_ + (size_t) begin * n, end - begin, n,
+          vecC.data_ + begin, 0.0, partial + (size_t) c * n);
+  });
+  for (int j=0; j<n; j++) {
+    data_[j] = (d == 0.0) ? 0.0 : d * data_[j];
+  }
+  for (int c=0; c<nChunks; c++) {
+    for (int j=0; j<n; j++) {
+      data_[j] += partial[(size_t) c * n + j];
+    }
+  }
+  if (pool != NULL) {
+    pool->release();
+  }
+}
+
 // // computes the GEMV this = a * matB^T * vecC + d * this
 // void Vector::matrixTVector(double a, Matrix& matB, Vector& vecC, double d) {
 //   assert(m_ == matB.n_);
@@ -15,6 +15,7 @@
 #include <assert.h>
 
 class Matrix;
+class ThreadPool;
 
 class Vector {
   public:
@@ -41,6 +42,7 @@ class Vector {
     void sigmoid();
     void aTimesOneMinusA();
     void softMax();
+    void softMax(ThreadPool*);
 
     void getColumn(Matrix&, int);
     void getRow(Matrix&, int);
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "Vocabulary.h"
+#include "Utf8.h"
+#include "Utils.h"
+#include <algorithm>
+
+Vocabulary::Vocabulary() {
+  words_.add("<unk>");
+  wordCount_.push_back(0);
+  V1_ = 0;
+  V2_ = 0;
+}
+
+int Vocabulary::size() const {
+  return words_.size();
+}
+
+int Vocabulary::getV1() const {
+  return V1_;
+}
+
+int Vocabulary::getV2() const {
+  return V2_;
+}
+
+// returns the V0 id of a word, -1 if it is not in the vocabulary
+int Vocabulary::find(const std::string& word) const {
+  return words_.find(word);
+}
+
+// adds count occurrences of a word, returns its V0 id
+int Vocabulary::addWord(const std::string& word, int count) {
+  int idx = words_.add(word);
+  if (idx < wordCount_.size()) {
+    wordCount_[idx] += count;
+  } else {
+    wordCount_.push_back(count);
+  }
+  return idx;
+}
+
+int Vocabulary::addChar(wchar_t c) {
+  return chars_.addChar(c);
+}
+
+const CharTable& Vocabulary::getCharTable() const {
+  return chars_;
+}
+
+std::string Vocabulary::getWord(int i) const {
+  return words_.get(i);
+}
+
+int Vocabulary::getCount(int i) const {
+  return wordCount_[i];
+}
+
+// the words of the other corpora have ids past the vocabulary, they are out
+// of V1 and V2
+int Vocabulary::getRestrictedId1(int i) const {
+  return i < restrictedVocab1_.size() ? restrictedVocab1_[i] : 0;
+}
+
+int Vocabulary::getRestrictedId2(int i) const {
+  return i < restrictedVocab2_.size() ? restrictedVocab2_[i] : 0;
+}
+
+// return the word id in the input vocabulary V1
+// if not present, provide the id of <unk>
+int Vocabulary::getWordId(const std::string& word) const {
+  int idx = find(word);
+  return idx < 0 ? 0 : restrictedVocab1_[idx];
+}
+
+void Vocabulary::randomWord(int& wordId, std::string& word) const {
+  int id = intRand(0, size());
+  wordId = restrictedVocab1_[id];
+  word = words_.get(id);
+}
+
+// the span of a word of n chars is '_', the n chars, '_' and '_', the word
+// module reading the n + 2 first ids as the input and target chars
+void Vocabulary::getSpan(int i, const int*& chars, int& nChars) const {
+  chars = charIds_.data() + spanStart_[i];
+  nChars = spanStart_[i + 1] - spanStart_[i] - 3;
+}
+
+// appends the span of a word to charIds, the chars missing from the table
+// are given the id 0 and the chars past MAX_WORD_LENGTH - 2 are dropped
+void Vocabulary::appendSpan(const std::string& word,
+                            std::vector<int>& charIds) const {
+  std::vector<wchar_t> chars(word.size() + 1);
+  int n = decodeUtf8(word, chars.data(), chars.size());
+  n = std::min(n, MAX_WORD_LENGTH - 2);
+  int space = chars_.getId('_');
+  charIds.push_back(space);
+  for (int j=0; j<n; j++) {
+    charIds.push_back(std::max(chars_.getId(chars[j]), 0));
+  }
+  charIds.push_back(space);
+  charIds.push_back(space);
+}
+
+// decodes every word once into a flat table of char ids
+void Vocabulary::buildCharSpans() {
+  charIds_.clear();
+  spanStart_.assign(1, 0);
+  for (int i=0; i<words_.size(); i++) {
+    appendSpan(words_.get(i), charIds_);
+    spanStart_.push_back(charIds_.size());
+  }
+}
+
+// the restricted ids are given in V0 order, <unk> (V0 id 0) staying at 0,
+// this completes the vocabulary
+void Vocabulary::computeRestrictedVocabs(int V1, int V2) {
+
+  // sorting the word occurences
+  std::vector<int> counts(wordCount_.begin() + 1, wordCount_.end());
+  std::sort(counts.begin(), counts.end(), [](int a, int b) {
+      return b < a;
+  });
+
+  int nWords = words_.size();
+  restrictedVocab1_.assign(nWords, 0);
+  restrictedVocab2_.assign(nWords, 0);
+  int k1 = 0;
+  int k2 = 0;
+  for (int i=1; i<nWords; i++) {
+    if (wordCount_[i] <= V1) {
+      continue;
+    }
+    k1++;
+    restrictedVocab1_[i] = k1;
+    if (wordCount_[i] >= counts[V2]) {
+      k2++;
+      restrictedVocab2_[i] = k2;
+    }
+  }
+  V1_ = k1;
+  V2_ = k2;
+  buildCharSpans();
+}
+
+// the char table, the words with their counts and restricted ids
+void Vocabulary::write(CacheWriter& cache) const {
+  std::wstring chars;
+  for (int i=0; i<chars_.size(); i++) {
+    chars.push_back(chars_.getChar(i));
+  }
+  cache.writeWString(chars);
+  cache.writeInt(words_.size());
+  for (int i=0; i<words_.size(); i++) {
+    cache.writeString(words_.get(i));
+  }
+  cache.writeInts(wordCount_);
+  cache.writeInts(restrictedVocab1_);
+  cache.writeInts(restrictedVocab2_);
+  cache.writeInt(V1_);
+  cache.writeInt(V2_);
+}
+
+// reads a vocabulary written by write into an empty one
+bool Vocabulary::read(CacheReader& cache) {
+  std::wstring chars = cache.readWString();
+  int nWords = cache.readInt();
+  std::vector<std::string> words;
+  for (int i=0; i<nWords && cache.good(); i++) {
+    words.push_back(cache.readString());
+  }
+  std::vector<int> counts;
+  std::vector<int> v1;
+  std::vector<int> v2;
+  cache.readInts(counts);
+  cache.readInts(v1);
+  cache.readInts(v2);
+  int V1 = cache.readInt();
+  int V2 = cache.readInt();
+  if (!cache.good() || counts.size() != nWords || v1.size() != nWords ||
+      v2.size() != nWords) {
+    return false;
+  }
+  // the restricted ids index the rows of the model
+  for (int i=0; i<nWords; i++) {
+    if (v1[i] < 0 || v1[i] > V1 || v2[i] < 0 || v2[i] > V2) {
+      return false;
+    }
+  }
+
+  words_ = WordTable();
+  for (int i=0; i<chars.size(); i++) {
+    chars_.addChar(chars[i]);
+  }
+  for (int i=0; i<nWords; i++) {
+    words_.add(words[i]);
+  }
+  wordCount_.swap(counts);
+  restrictedVocab1_.swap(v1);
+  restrictedVocab2_.swap(v2);
+  V1_ = V1;
+  V2_ = V2;
+  buildCharSpans();
+  return true;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef VOCABULARY_H
+#define VOCABULARY_H
+
+#include <string>
+#include <vector>
+#include "CacheFile.h"
+#include "CharTable.h"
+#include "WordTable.h"
+
+// size of the char buffers of a word module, the spans of longer words are
+// cut to fit
+const int MAX_WORD_LENGTH = 200;
+
+// Words and chars of the training corpus. It is built by the training data
+// provider, then frozen and shared through a pointer to const by the other
+// providers and the network. The words are indexed by their V0 id, <unk>
+// being 0, their restricted ids are 0 when they are out of V1/V2.
+class Vocabulary {
+  private:
+    WordTable words_;
+    std::vector<int> wordCount_;
+    std::vector<int> restrictedVocab1_;
+    std::vector<int> restrictedVocab2_;
+    int V1_;
+    int V2_;
+    CharTable chars_;
+
+    // char ids of every word, see appendSpan
+    std::vector<int> charIds_;
+    std::vector<size_t> spanStart_;
+
+    void buildCharSpans();
+
+  public:
+    Vocabulary();
+    int size() const;
+    int getV1() const;
+    int getV2() const;
+    int find(const std::string&) const;
+    int addWord(const std::string&, int);
+    int addChar(wchar_t);
+    const CharTable& getCharTable() const;
+    std::string getWord(int) const;
+    int getCount(int) const;
+    int getRestrictedId1(int) const;
+    int getRestrictedId2(int) const;
+    int getWordId(const std::string&) const;
+    void randomWord(int&, std::string&) const;
+    void getSpan(int, const int*&, int&) const;
+    void appendSpan(const std::string&, std::vector<int>&) const;
+    void computeRestrictedVocabs(int, int);
+    void write(CacheWriter&) const;
+    bool read(CacheReader&);
+};
+
+#endif
@@ -8,16 +8,15 @@
  */
 
 #include "WordModule.h"
+#include "Utf8.h"
 #include <iostream>
 #include <math.h>
 #include <float.h>
+#include <assert.h>
 
-WordModule2::WordModule2(Model& modelRef,
-    std::unordered_map<wchar_t,int>& char2int,
-    std::unordered_map<int, wchar_t>& int2char)
+WordModule2::WordModule2(Model& modelRef, const CharTable& chars)
     : model_(modelRef),
-      char2int_(char2int),
-      int2char_(int2char),
+      chars_(chars),
       dcTemp_(modelRef.dc),
       mcTemp_(modelRef.mc),
       dwTemp_(modelRef.dwV2),
@@ -25,10 +24,11 @@ WordModule2::WordModule2(Model& modelRef,
       hp_(MAX_WORD_LENGTH, Vector(modelRef.mc)),
       mup_(MAX_WORD_LENGTH, Vector(modelRef.mc)),
       yp_(MAX_WORD_LENGTH, Vector(modelRef.dc)),
-      cp_(MAX_WORD_LENGTH, 0),
+      cp_(NULL),
       Yt_(modelRef.dwV2),
       Ht_(modelRef.mw),
-      lambda_(modelRef.mw) {
+      lambda_(modelRef.mw),
+      QHt_(modelRef.mc) {
   wt_ = 0;
   wtp1_ = 0;
   dcTemp_.fillValue(0.0);
@@ -40,20 +40,15 @@ WordModule2::WordModule2(Model& modelRef,
 WordModule2::~WordModule2() {
 }
 
-void WordModule2::loadData(int w, int wtp1, std::string& string_tp1) {
+void WordModule2::loadData(int w, int wtp1, const int* chars, int nChars) {
   wt_ = w;
   wtp1_ = wtp1;
 
-  wchar_t wideChars[1000];
-  size_t nChars = mbstowcs(wideChars, string_tp1.c_str(), 1000);
-
-  // lastChar is the length of the string plus one for the first char
+  // lastChar is the length of the string plus one for the first char, the
+  // span starts with an underscore and ends with two
+  assert(nChars + 1 < MAX_WORD_LENGTH);
   lastChar = nChars + 1;
-  cp_[0] = char2int_['_'];
-  for (int i=0; i<lastChar; i++) {
-    cp_[i+1] = char2int_[wideChars[i]];
-  }
-  cp_[lastChar+1] = char2int_['_'];
+  cp_ = chars;
 }
 
 // forward takes as input the previous hidden
@@ -62,32 +57,43 @@ void WordModule2::forward(Vector& Htm1,
                           double& wordEntropy,
                           double& charEntropy) {
 
+  forwardHidden(Htm1);
+  forwardWordOutput(wordEntropy);
+  QHt_.matrixVector(1.0, model_.Q_, Ht_, 0.0);
+  forwardChars(htm1P, charEntropy);
+}
+
+// the word hidden only depends on the previous one and on the word
+void WordModule2::forwardHidden(Vector& Htm1) {
   Ht_.getRow(model_.Aw_, wt_);
   Ht_.matrixVector(1.0, model_.Rw_, Htm1, 1.0);
   Ht_.sigmoid();
+}
 
+void WordModule2::forwardWordOutput(double& wordEntropy) {
   if (model_.alpha_ > 0.01) {
     Yt_.matrixVector(1.0, model_.Uw_, Ht_, 0.0);
     Yt_.softMax();
     wordEntropy -= log(Yt_.get(wtp1_) + DBL_MIN) / log(2.0);
   }
+}
 
+// the char level of forward, QHt_ holding the contribution of the word
+// hidden to every char hidden
+void WordModule2::forwardChars(Vector& htm1P, double& charEntropy) {
   for (int i=0; i<lastChar; i++) {
-    // computing character hidden
     hp_[i].getRow(model_.Ac_, cp_[i]);
     if (i==0) {
       hp_[i].matrixVector(1.0, model_.Rc_, htm1P, 1.0);
     } else {
       hp_[i].matrixVector(1.0, model_.Rc_, hp_[i-1], 1.0);
     }
-    hp_[i].matrixVector(1.0, model_.Q_, Ht_, 1.0);
+    hp_[i].addInPlace(QHt_);
     hp_[i].sigmoid();
 
-    // computing character output
     yp_[i].matrixVector(1.0, model_.Uc_, hp_[i], 0.0);
     yp_[i].softMax();
     charEntropy -= log(yp_[i].get(cp_[i+1]) + DBL_MIN) / log(2.0);
-    // std::cout << charEntropy << " " << yp_[i].get(cp_[i+1]) << std::endl;
   }
 }
 
@@ -183,14 +189,15 @@ std::string WordModule2::generate(int wordId, Vector& Htm1, Vector& htm1P) {
   Ht_.matrixVector(1.0, model_.Rw_, Htm1, 1.0);
   Ht_.sigmoid();
 
-  int charId = char2int_['_'];
+  int space = chars_.getId('_');
+  int charId = space;
   std::string res;
   wchar_t c;
   char mbs[16];
   int nBytes = 0;
 
   int i = 0;
-  while ((charId!=char2int_['_'] || i==0) && i<MAX_WORD_LENGTH) {
+  while ((charId!=space || i==0) && i<MAX_WORD_LENGTH) {
     // computing character hidden
     hp_[i].getRow(model_.Ac_, charId);
     if (i==0) {
@@ -205,8 +212,8 @@ std::string WordModule2::generate(int wordId, Vector& Htm1, Vector& htm1P) {
     yp_[i].matrixVector(1.0, model_.Uc_, hp_[i], 0.0);
     yp_[i].softMax();
     charId = sampleFromVector(yp_[i]);
-    c = int2char_[charId];
-    nBytes = wctomb(mbs, c);
+    c = chars_.getChar(charId);
+    nBytes = encodeUtf8(c, mbs);
     for (int j=0; j<nBytes; j++) {
       res.push_back(mbs[j]);
     }
@@ -214,7 +221,7 @@ std::string WordModule2::generate(int wordId, Vector& Htm1, Vector& htm1P) {
   }
   lastChar = i;
 
-  if (i==MAX_WORD_LENGTH && charId!=char2int_['_']) {
+  if (i==MAX_WORD_LENGTH && charId!=space) {
     res.push_back('_');
   }
 
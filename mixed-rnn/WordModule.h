@@ -11,19 +11,18 @@
 #define WORDMODULE2_H
 
 #include "Model.h"
+#include "CharTable.h"
+#include "Vocabulary.h"
 #include "Vector.h"
 #include <vector>
 #include <string>
 #include <unordered_map>
 
-const int MAX_WORD_LENGTH = 200;
-
 class WordModule2 {
   private:
     // reference to shared model
     Model& model_;
-    std::unordered_map<wchar_t, int>& char2int_;
-    std::unordered_map<int, wchar_t>& int2char_;
+    const CharTable& chars_;
 
     // temporary results in dimension d and m
     Vector dcTemp_;
@@ -39,7 +38,8 @@ class WordModule2 {
   private:
     std::vector<Vector> yp_;
     std::vector<Vector> nup_;
-    std::vector<int> cp_;
+    // span of the char ids of the word, owned by the data provider
+    const int* cp_;
     Vector Yt_;
 
   public:
@@ -48,13 +48,17 @@ class WordModule2 {
     int wtp1_;
     Vector Ht_;
     Vector lambda_;
+    // product of Q_ with Ht_, given to forwardChars
+    Vector QHt_;
 
     int lastChar;
-    WordModule2(Model&, std::unordered_map<wchar_t, int>&,
-        std::unordered_map<int, wchar_t>&);
+    WordModule2(Model&, const CharTable&);
     ~WordModule2();
-    void loadData(int, int, std::string&);
+    void loadData(int, int, const int*, int);
     void forward(Vector&, Vector&, double&, double&);
+    void forwardHidden(Vector&);
+    void forwardWordOutput(double&);
+    void forwardChars(Vector&, double&);
     void backward(Vector&, Vector&, Vector&, Vector&, Vector&, Vector&);
     void printChars();
     std::string generate(int, Vector&, Vector&);
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "WordTable.h"
+#include <assert.h>
+#include <string.h>
+
+// FNV-1a
+static uint64_t hashWord(const char* word, size_t length) {
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i=0; i<length; i++) {
+    h = (h ^ (unsigned char) word[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+WordTable::WordTable()
+    : offsets_(1, 0),
+      slots_(16, -1) {
+}
+
+int WordTable::size() const {
+  return hashes_.size();
+}
+
+// returns the slot of a word, or the empty slot where it should go
+size_t WordTable::findSlot(const char* word, size_t length,
+                           uint64_t h) const {
+  size_t mask = slots_.size() - 1;
+  size_t i = h & mask;
+  while (true) {
+    int id = slots_[i];
+    if (id < 0) {
+      return i;
+    }
+    if (hashes_[id] == h && offsets_[id + 1] - offsets_[id] == length &&
+        memcmp(arena_.data() + offsets_[id], word, length) == 0) {
+      return i;
+    }
+    i = (i + 1) & mask;
+  }
+}
+
+// the words are not hashed again, their hash is kept
+void WordTable::grow() {
+  slots_.assign(2 * slots_.size(), -1);
+  size_t mask = slots_.size() - 1;
+  for (int id=0; id<hashes_.size(); id++) {
+    size_t i = hashes_[id] & mask;
+    while (slots_[i] >= 0) {
+      i = (i + 1) & mask;
+    }
+    slots_[i] = id;
+  }
+}
+
+// returns the id of a word, -1 if it is not in the table
+int WordTable::find(const char* word, size_t length) const {
+  return slots_[findSlot(word, length, hashWord(word, length))];
+}
+
+int WordTable::find(const std::string& word) const {
+  return find(word.data(), word.size());
+}
+
+// returns the id of a word, adding it to the table if needed
+int WordTable::add(const char* word, size_t length) {
+  uint64_t h = hashWord(word, length);
+  size_t slot = findSlot(word, length, h);
+  if (slots_[slot] >= 0) {
+    return slots_[slot];
+  }
+  int id = hashes_.size();
+  arena_.insert(arena_.end(), word, word + length);
+  offsets_.push_back(arena_.size());
+  hashes_.push_back(h);
+  slots_[slot] = id;
+  if (2 * hashes_.size() > slots_.size()) {
+    grow();
+  }
+  return id;
+}
+
+int WordTable::add(const std::string& word) {
+  return add(word.data(), word.size());
+}
+
+std::string WordTable::get(int id) const {
+  assert(id >= 0 && id < hashes_.size());
+  return std::string(arena_.data() + offsets_[id],
+      offsets_[id + 1] - offsets_[id]);
+}
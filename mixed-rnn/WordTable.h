@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2015-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef WORDTABLE_H
+#define WORDTABLE_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+// Two way map between words and their ids, given in order of insertion.
+// The words are interned one after the other in a single byte arena, and
+// found through an open addressing table of ids kept at most half full,
+// with the hash of every word to skip most comparisons.
+class WordTable {
+  private:
+    std::vector<char> arena_;
+    std::vector<size_t> offsets_;
+    std::vector<uint64_t> hashes_;
+    std::vector<int> slots_;
+
+    size_t findSlot(const char*, size_t, uint64_t) const;
+    void grow();
+
+  public:
+    WordTable();
+    int size() const;
+    int find(const char*, size_t) const;
+    int find(const std::string&) const;
+    int add(const char*, size_t);
+    int add(const std::string&);
+    std::string get(int) const;
+};
+
+#endif